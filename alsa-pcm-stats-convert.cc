@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <iostream>
+
+#include "trace_format.cc"
+
+// Converts binary traces written with --output-format binary back into the
+// text table of the measurement tools or into CSV.
+
+std::string input_file_name;
+std::string output_file_name;
+std::string format;
+int show_header;
+int show_info;
+
+int main(int argc, char *argv[]) {
+    namespace po = boost::program_options;
+
+    po::options_description options_desc("Options");
+    options_desc.add_options()
+        ("help,h", "produce this help message")
+        ("input,i", po::value<std::string>(&input_file_name), "the trace file to convert")
+        ("output,O", po::value<std::string>(&output_file_name)->default_value("-"), "the file to write to (-: stdout)")
+        ("format,f", po::value<std::string>(&format)->default_value("text"), "the output format. Available formats: text, csv")
+        ("show-header,e", po::value<int>(&show_header)->default_value(1), "whether to show a header in the output")
+        ("info", po::value<int>(&show_info)->default_value(0), "whether to print the run parameters from the trace header to stderr")
+    ;
+
+    po::positional_options_description positional_desc;
+    positional_desc.add("input", 1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(options_desc).positional(positional_desc).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || input_file_name.empty()) {
+        std::cout << "Usage: " << argv[0] << " [options] trace-file\n" << options_desc << "\n";
+        exit(vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (format != "text" && format != "csv") {
+        fprintf(stderr, "Error: unsupported format: %s\n", format.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    trace_file trace;
+    std::string error = trace.open(input_file_name.c_str());
+    if (!error.empty()) {
+        fprintf(stderr, "Error: %s: %s\n", input_file_name.c_str(), error.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    const trace_header &header = trace.header;
+    if (show_info) {
+        fprintf(stderr, "version: %u\n", header.version);
+        fprintf(stderr, "pcm-device-names: %s\n", header.pcm_device_name);
+        fprintf(stderr, "period-size: %d\n", header.period_size_frames);
+        fprintf(stderr, "number-of-periods: %d\n", header.num_periods);
+        fprintf(stderr, "rate: %d\n", header.sampling_rate_hz);
+        fprintf(stderr, "input-channels: %d\n", header.input_channels);
+        fprintf(stderr, "output-channels: %d\n", header.output_channels);
+        fprintf(stderr, "sample-bytes: %d\n", header.sample_bytes);
+        fprintf(stderr, "sample-format: %s\n", header.sample_format < (uint32_t)trace_num_sample_formats ? trace_sample_format_names[header.sample_format] : "unknown");
+        fprintf(stderr, "processing-buffer-size: %d\n", header.processing_buffer_frames);
+        fprintf(stderr, "load: %d\n", header.load_percent);
+        fprintf(stderr, "threads: %d\n", header.threads);
+        fprintf(stderr, "access: %s\n", trace_access_names[header.access & (trace_access_mmap | trace_access_planar)]);
+        fprintf(stderr, "conversion-kernels: %s\n", header.conversion_kernels);
+        fprintf(stderr, "phase-timing: %d\n", (header.record_fields & trace_fields_phases) ? 1 : 0);
+        fprintf(stderr, "perf-counters: %d\n", (header.record_fields & trace_fields_perf_counters) ? 1 : 0);
+        fprintf(stderr, "records: %zu\n", trace.num_records);
+    }
+
+    FILE *output = stdout;
+    if (output_file_name != "-") {
+        output = fopen(output_file_name.c_str(), "w");
+        if (!output) {
+            fprintf(stderr, "Error: fopen %s: %s\n", output_file_name.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    static char output_buffer[1024 * 1024];
+    setvbuf(output, output_buffer, _IOFBF, sizeof(output_buffer));
+
+    const bool csv = (format == "csv");
+
+    // traces of --phase-timing and --perf-counters runs have extra columns
+    const bool phases = header.record_fields & trace_fields_phases;
+    const bool perf = header.record_fields & trace_fields_perf_counters;
+
+    if (show_header) {
+        if (csv) {
+            fprintf(output, "tv_sec,tv_nsec,avail_w,avail_r,pollout,pollin,written,read,total_w,total_r,diff,fill,drain,cycles,valid,delay_w,delay_r,hw_lag_ns,io_ns,device");
+            for (int phase = 0; phases && phase < trace_num_phases; ++phase) {
+                std::string name = trace_phase_names[phase];
+                std::replace(name.begin(), name.end(), '-', '_');
+                fprintf(output, ",%s_ns", name.c_str());
+            }
+            for (int counter = 0; perf && counter < trace_num_perf_counters; ++counter) {
+                std::string name = trace_perf_counter_names[counter];
+                std::replace(name.begin(), name.end(), '-', '_');
+                fprintf(output, ",%s", name.c_str());
+            }
+        }
+        else {
+            fprintf(output, "   tv.sec   tv.nsec avail-w avail-r POLLOUT POLLIN written    read total-w total-r diff fill drain       cycles delay-w delay-r  hw-lag-ns      io-ns dev");
+            for (int phase = 0; phases && phase < trace_num_phases; ++phase) {
+                fprintf(output, " %*s-ns", trace_phase_column_width(phase) - 3, trace_phase_names[phase]);
+            }
+            for (int counter = 0; perf && counter < trace_num_perf_counters; ++counter) {
+                fprintf(output, " %*s", trace_perf_counter_column_width(counter), trace_perf_counter_names[counter]);
+            }
+        }
+        fprintf(output, "\n");
+    }
+
+    // per device
+    std::vector<uint64_t> totals_written;
+    std::vector<uint64_t> totals_read;
+
+    for (size_t index = 0; index < trace.num_records; ++index) {
+        trace_record record;
+        trace.record(index, record);
+        if (record.type == trace_record_corunner_phase) {
+            // a comment line like the measurement tool writes, csv has none
+            if (!csv) {
+                const int kind = record.playback_available;
+                fprintf(output, "# %09ld.%09d corunner %d %s %s\n", record.tv_sec, record.tv_nsec, record.device, (kind >= 0 && kind < trace_num_corunner_kinds) ? trace_corunner_kind_names[kind] : "?", (record.flags & trace_flag_corunner_on) ? "on" : "off");
+            }
+            continue;
+        }
+        if (record.type != trace_record_sample) { continue; }
+
+        if (record.device >= totals_written.size()) {
+            totals_written.resize(record.device + 1, 0);
+            totals_read.resize(record.device + 1, 0);
+        }
+        const uint64_t total_written = totals_written[record.device] += record.playback_written;
+        const uint64_t total_read = totals_read[record.device] += record.capture_read;
+
+        const int pollout = (record.flags & trace_flag_pollout) ? 1 : 0;
+        const int pollin = (record.flags & trace_flag_pollin) ? 1 : 0;
+        const int valid = (record.flags & trace_flag_valid) ? 1 : 0;
+
+        if (csv) {
+            fprintf(output, "%ld,%d,%d,%d,%d,%d,%d,%d,%lu,%lu,%ld,%d,%d,%lu,%d,%d,%d,%d,%d,%d", record.tv_sec, record.tv_nsec, record.playback_available, record.capture_available, pollout, pollin, record.playback_written, record.capture_read, total_written, total_read, total_read - total_written, record.fill, record.drain, record.cycles, valid, record.playback_delay, record.capture_delay, record.hw_lag_ns, record.io_ns, record.device);
+            for (int phase = 0; phases && phase < trace_num_phases; ++phase) {
+                fprintf(output, ",%u", trace_decode_duration(record.phase_codes[phase]));
+            }
+            for (int counter = 0; perf && counter < trace_num_perf_counters; ++counter) {
+                fprintf(output, ",%u", record.perf_deltas[counter]);
+            }
+        }
+        else {
+            fprintf(output, "%09ld.%09d %7d %7d %7d %6d %7d %7d %7ld %7ld %4ld %4d %5d %12ld %7d %7d %10d %10d %3d", record.tv_sec, record.tv_nsec, record.playback_available, record.capture_available, pollout, pollin, record.playback_written, record.capture_read, total_written, total_read, total_read - total_written, record.fill, record.drain, record.cycles, record.playback_delay, record.capture_delay, record.hw_lag_ns, record.io_ns, record.device);
+            for (int phase = 0; phases && phase < trace_num_phases; ++phase) {
+                fprintf(output, " %*u", trace_phase_column_width(phase), trace_decode_duration(record.phase_codes[phase]));
+            }
+            for (int counter = 0; perf && counter < trace_num_perf_counters; ++counter) {
+                fprintf(output, " %*u", trace_perf_counter_column_width(counter), record.perf_deltas[counter]);
+            }
+        }
+        fprintf(output, "\n");
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <boost/program_options.hpp>
+#include <iostream>
+
+#include "live_format.cc"
+
+// Shows the live stats an alsa-pcm-stats run publishes with --live-stats,
+// top-style: per sampling thread the wakeup jitter percentiles of the last
+// interval, the latest fill, drain and avail, the xruns and the cpu use.
+
+std::string live_stats_name;
+double interval_s;
+int iterations;
+int batch;
+
+// A consistent copy, spinning while the writer stores. The writer holds
+// a seqlock for a few hundred nanoseconds.
+template <typename T>
+static void load(const live_seqlock<T> &lock, T &values) {
+    while (!lock.try_load(values)) { sched_yield(); }
+}
+
+// The user plus system time of a process or thread in clock ticks, from
+// a /proc/.../stat file, or -1.
+static long long cpu_ticks(const std::string &stat_path) {
+    FILE *file = fopen(stat_path.c_str(), "r");
+    if (!file) { return -1; }
+    char line[1024];
+    const bool ok = fgets(line, sizeof(line), file) != NULL;
+    fclose(file);
+    if (!ok) { return -1; }
+
+    // the fields after the command name, which may contain spaces,
+    // starting with the state as field 3
+    const char *fields = strrchr(line, ')');
+    if (!fields) { return -1; }
+    unsigned long utime, stime;
+    if (sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) { return -1; }
+    return utime + stime;
+}
+
+static std::string thread_stat_path(int pid, int tid) {
+    return "/proc/" + std::to_string(pid) + "/task/" + std::to_string(tid) + "/stat";
+}
+
+// The jitter below which the fraction of the samples counted lies, from
+// the bucket counts of an interval.
+static int64_t jitter_percentile_ns(const uint64_t *counts, uint64_t total, double fraction) {
+    uint64_t cumulative = 0;
+    for (int bucket = 0; bucket < live_jitter_buckets; ++bucket) {
+        cumulative += counts[bucket];
+        if (cumulative >= fraction * total) { return live_jitter_bucket_limit_ns(bucket); }
+    }
+    return live_jitter_bucket_limit_ns(live_jitter_buckets - 1);
+}
+
+static int64_t now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    namespace po = boost::program_options;
+
+    po::options_description options_desc("Options");
+    options_desc.add_options()
+        ("help,h", "produce this help message")
+        ("name,n", po::value<std::string>(&live_stats_name), "the --live-stats name of the run to show")
+        ("interval,d", po::value<double>(&interval_s)->default_value(1), "the seconds between updates")
+        ("iterations", po::value<int>(&iterations)->default_value(0), "the number of updates before exiting (0: until the run exits)")
+        ("batch,b", po::value<int>(&batch)->default_value(0), "whether to append the updates instead of redrawing the terminal")
+    ;
+
+    po::positional_options_description positional_desc;
+    positional_desc.add("name", 1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(options_desc).positional(positional_desc).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || live_stats_name.empty()) {
+        std::cout << "Usage: " << argv[0] << " [options] name\n" << options_desc << "\n";
+        exit(vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (interval_s <= 0) {
+        fprintf(stderr, "Error: invalid interval: %g\n", interval_s);
+        exit(EXIT_FAILURE);
+    }
+
+    const std::string shm_name = "/" + live_stats_name;
+    const int fd = shm_open(shm_name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error: shm_open %s: %s\n", shm_name.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(live_segment)) {
+        fprintf(stderr, "Error: %s: not an alsa-pcm-stats live stats segment\n", shm_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+    void *mapped = mmap(NULL, sizeof(live_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap %s: %s\n", shm_name.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    const live_segment &segment = *(const live_segment*)mapped;
+    if (memcmp(segment.magic, live_magic, sizeof(live_magic)) != 0) {
+        fprintf(stderr, "Error: %s: not an alsa-pcm-stats live stats segment\n", shm_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (segment.version != live_version || segment.bytes != sizeof(live_segment)) {
+        fprintf(stderr, "Error: %s: unsupported live stats version %u\n", shm_name.c_str(), segment.version);
+        exit(EXIT_FAILURE);
+    }
+
+    const long ticks_per_s = sysconf(_SC_CLK_TCK);
+
+    // of the previous update, to show the last interval
+    live_run previous_run;
+    memset(&previous_run, 0, sizeof(previous_run));
+    live_thread_values previous[live_max_threads];
+    memset(previous, 0, sizeof(previous));
+    long long previous_ticks[live_max_threads + 1];
+    int64_t previous_ns = now_ns();
+
+    for (int iteration = 0; iterations == 0 || iteration < iterations; ++iteration) {
+        live_run run;
+        load(segment.run, run);
+        live_thread_values threads[live_max_threads];
+        const int num_threads = std::min(std::max(run.threads, 0), live_max_threads);
+        for (int index = 0; index < num_threads; ++index) { load(segment.threads[index], threads[index]); }
+
+        const int64_t update_ns = now_ns();
+        const double seconds = (update_ns - previous_ns) * 1e-9;
+
+        // the threads and their previous values belong to another measurement
+        const bool restarted = iteration == 0 || run.start_ns != previous_run.start_ns || run.pid != previous_run.pid;
+
+        long long ticks[live_max_threads + 1];
+        ticks[live_max_threads] = cpu_ticks("/proc/" + std::to_string(run.pid) + "/stat");
+        for (int index = 0; index < num_threads; ++index) {
+            ticks[index] = threads[index].tid ? cpu_ticks(thread_stat_path(run.pid, threads[index].tid)) : -1;
+        }
+
+        bool alive = run.state != live_state_exited;
+        if (alive && run.pid > 0 && kill(run.pid, 0) != 0 && errno == ESRCH) { alive = false; }
+
+        if (!batch) { printf("\033[H\033[2J"); }
+        printf("alsa-pcm-stats %d on %s: %s, measurement %d/%d, %d x %d frames at %d hz", run.pid, run.pcm_device_names, alive ? live_state_names[run.state] : "exited", run.measurement, run.measurements, run.period_size_frames, run.num_periods, run.sampling_rate_hz);
+        if (run.state == live_state_running && alive) { printf(", %.1f s", (update_ns - run.start_ns) * 1e-9); }
+        printf("\n");
+        if (!restarted && ticks[live_max_threads] >= 0 && previous_ticks[live_max_threads] >= 0) {
+            printf("process cpu: %.1f%%\n", 100.0 * (ticks[live_max_threads] - previous_ticks[live_max_threads]) / ticks_per_s / seconds);
+        }
+        else {
+            printf("process cpu: -\n");
+        }
+        printf("%-28s %10s %8s %9s %9s %9s %9s %6s %6s %7s %7s %6s %6s\n", "thread", "samples", "rate", "jitter", "p50", "p99", "max", "fill", "drain", "avail-w", "avail-r", "xruns", "cpu%");
+
+        for (int index = 0; index < num_threads; ++index) {
+            const live_thread_values &values = threads[index];
+            const live_thread_values &before = previous[index];
+
+            uint64_t counts[live_jitter_buckets];
+            uint64_t total = 0;
+            for (int bucket = 0; bucket < live_jitter_buckets; ++bucket) {
+                counts[bucket] = restarted ? values.jitter_counts[bucket] : values.jitter_counts[bucket] - before.jitter_counts[bucket];
+                total += counts[bucket];
+            }
+
+            char rate[16] = "-";
+            char p50[16] = "-";
+            char p99[16] = "-";
+            char cpu[16] = "-";
+            if (!restarted) { snprintf(rate, sizeof(rate), "%.0f/s", (values.samples - before.samples) / seconds); }
+            if (total) {
+                snprintf(p50, sizeof(p50), "<%.1fus", jitter_percentile_ns(counts, total, 0.5) * 1e-3);
+                snprintf(p99, sizeof(p99), "<%.1fus", jitter_percentile_ns(counts, total, 0.99) * 1e-3);
+            }
+            if (!restarted && ticks[index] >= 0 && previous_ticks[index] >= 0 && values.tid == before.tid) {
+                snprintf(cpu, sizeof(cpu), "%.1f", 100.0 * (ticks[index] - previous_ticks[index]) / ticks_per_s / seconds);
+            }
+
+            printf("%-28.28s %10lu %8s %7.1fus %9s %9s %7.1fus %6d %6d %7d %7d %6lu %6s\n", values.title, values.samples, rate, values.jitter_ns * 1e-3, p50, p99, values.max_jitter_ns * 1e-3, values.fill, values.drain, values.playback_available, values.capture_available, values.xruns, cpu);
+        }
+        fflush(stdout);
+
+        previous_run = run;
+        memcpy(previous, threads, sizeof(threads));
+        memcpy(previous_ticks, ticks, sizeof(ticks));
+        previous_ns = update_ns;
+
+        if (!alive) { break; }
+
+        timespec ts;
+        ts.tv_sec = (time_t)interval_s;
+        ts.tv_nsec = (long)((interval_s - ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+    }
+
+    munmap(mapped, sizeof(live_segment));
+    return EXIT_SUCCESS;
+}
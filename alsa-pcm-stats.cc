@@ -0,0 +1,1016 @@
+#include <alsa/asoundlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sched.h>
+#include <malloc.h>
+#include <signal.h>
+
+#include <string>
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#include "arena.cc"
+#include "ringbuffer.cc"
+#include "trace_format.cc"
+#include "live_format.cc"
+
+const int max_pcm_devices = 8;
+
+int period_size_frames;
+int num_periods;
+int sampling_rate_hz;
+std::vector<std::string> pcm_device_names;
+std::vector<std::string> capture_pcm_device_names;
+std::vector<int> device_cpus;
+int irq_affinity;
+std::string sample_format_name;
+// an index into trace_sample_format_names
+int sample_format;
+std::string access_mode;
+bool mmap_access;
+// non-interleaved device buffers and a planar ringbuffer
+bool planar_access;
+int input_channels;
+int output_channels;
+int priority;
+int buffer_size_frames;
+int sizeof_sample;
+int min_channels;
+int sample_size;
+int verbose;
+int show_header;
+int sleep_percent;
+std::string load_type_name;
+std::string baseline_mode_name;
+int load_type;
+std::string dsp_chain_spec;
+std::vector<std::string> corunner_specs;
+int xrun_recovery;
+int phase_timing;
+int perf_counters_enabled;
+int busy_sleep_us;
+int prefault_heap_size_mb;
+int hugepages;
+int processing_buffer_frames;
+int num_threads;
+int stream_samples;
+int stream_queue_size;
+std::string output_file_name;
+std::string output_format;
+bool binary_output;
+FILE *output;
+volatile sig_atomic_t stop_requested = 0;
+int print_table;
+int print_summary_stats;
+int summary_interval_s;
+std::string conversion_kernels_name;
+int conversion_benchmark;
+std::string wait_strategy_name;
+int hybrid_max_spin_us;
+bool tsched;
+int tsched_buffer_frames;
+int device_buffer_frames;
+std::string backend_name;
+int sim_jitter_us;
+int sim_xrun_interval;
+double sim_drift_ppm;
+int sim_loopback_frames;
+int driver_timestamps;
+std::string roundtrip_signal_name;
+int roundtrip_signal;
+int roundtrip_interval_frames;
+int roundtrip_signal_frames;
+int roundtrip_channel;
+int sweep;
+std::string sweep_period_sizes;
+std::string sweep_num_periods;
+std::string sweep_processing_buffer_sizes;
+std::string sweep_loads;
+int sweep_repetitions;
+int sweep_seconds;
+
+struct data {
+    uint64_t cycles;
+    int valid;
+    int playback_available;
+    int capture_available;
+    struct timespec wakeup_time;
+    int poll_pollin;
+    int poll_pollout;
+    int playback_written;
+    int capture_read;
+    int fill;
+    int drain;
+    int playback_delay;
+    int capture_delay;
+    int hw_lag_ns;
+    int io_ns;
+    int device;
+    // with --phase-timing, in trace_phase_names order
+    uint32_t phase_ns[trace_num_phases];
+    // with --perf-counters, in trace_perf_counter_names order
+    uint32_t perf_deltas[trace_num_perf_counters];
+    
+    data() :
+        cycles(0),
+        valid(0),
+        playback_available(0),
+        capture_available(0),
+        wakeup_time{0, 0},
+        poll_pollin(0),
+        poll_pollout(0),
+        playback_written(0),
+        capture_read(0),
+        fill(0),
+        drain(0),
+        playback_delay(0),
+        capture_delay(0),
+        hw_lag_ns(0),
+        io_ns(0),
+        device(0),
+        phase_ns{},
+        perf_deltas{} {
+    
+    }
+};
+
+// Per device.
+struct sample_totals {
+    uint64_t written[max_pcm_devices];
+    uint64_t read[max_pcm_devices];
+
+    sample_totals() :
+        written{},
+        read{} {
+
+    }
+};
+
+void print_header(FILE *file) {
+    fprintf(file, "   tv.sec   tv.nsec avail-w avail-r POLLOUT POLLIN written    read total-w total-r diff fill drain       cycles delay-w delay-r  hw-lag-ns      io-ns dev");
+    if (phase_timing) {
+        for (int phase = 0; phase < trace_num_phases; ++phase) { fprintf(file, " %*s-ns", trace_phase_column_width(phase) - 3, trace_phase_names[phase]); }
+    }
+    if (perf_counters_enabled) {
+        for (int counter = 0; counter < trace_num_perf_counters; ++counter) { fprintf(file, " %*s", trace_perf_counter_column_width(counter), trace_perf_counter_names[counter]); }
+    }
+    fprintf(file, "\n");
+}
+
+void print_data_sample(FILE *file, const data &data_sample, sample_totals &totals) {
+    uint64_t &written = totals.written[data_sample.device];
+    uint64_t &read = totals.read[data_sample.device];
+    written += data_sample.playback_written;
+    read += data_sample.capture_read;
+    fprintf(file, "%09ld.%09ld %7d %7d %7d %6d %7d %7d %7ld %7ld %4ld %4d %5d %12ld %7d %7d %10d %10d %3d", data_sample.wakeup_time.tv_sec, data_sample.wakeup_time.tv_nsec, data_sample.playback_available, data_sample.capture_available, data_sample.poll_pollout, data_sample.poll_pollin, data_sample.playback_written, data_sample.capture_read, written, read, read - written, data_sample.fill, data_sample.drain, data_sample.cycles, data_sample.playback_delay, data_sample.capture_delay, data_sample.hw_lag_ns, data_sample.io_ns, data_sample.device);
+    if (phase_timing) {
+        for (int phase = 0; phase < trace_num_phases; ++phase) { fprintf(file, " %*u", trace_phase_column_width(phase), data_sample.phase_ns[phase]); }
+    }
+    if (perf_counters_enabled) {
+        for (int counter = 0; counter < trace_num_perf_counters; ++counter) { fprintf(file, " %*u", trace_perf_counter_column_width(counter), data_sample.perf_deltas[counter]); }
+    }
+    fprintf(file, "\n");
+}
+
+#include "convert.cc"
+#include "common.cc"
+#include "phases.cc"
+#include "perf.cc"
+#include "backend.cc"
+#include "sim.cc"
+#include "devices.cc"
+#include "engine.cc"
+#include "benchmark.cc"
+#include "histogram.cc"
+#include "summary.cc"
+#include "wait.cc"
+#include "timestamps.cc"
+#include "xrun.cc"
+#include "corunner.cc"
+#include "baseline.cc"
+#include "live.cc"
+#include "output.cc"
+#include "sample_store.cc"
+#include "stream.cc"
+#include "fft.cc"
+#include "roundtrip.cc"
+#include "load.cc"
+#include "split.cc"
+#include "sweep.cc"
+
+// Fills the playback buffer of the prepared device with silence up to the
+// latency, which starts both devices. Returns 0 or a negative error code.
+static int prefill_playback(pcm_device &device, wait_context &waits) {
+    if (verbose) { fprintf(stderr, "Filling output buffer with zeros\n"); }
+
+    int avail_playback = backend->avail(device.playback);
+    if (avail_playback < 0) {
+        fprintf(stderr, "Error: avail_playback %s: %s\n", device.name.c_str(), snd_strerror(avail_playback));
+        exit(EXIT_FAILURE);
+    }
+
+    if (avail_playback != device_buffer_frames) {
+        fprintf(stderr, "Error: no full buffer available on %s\n", device.name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    memset(device.output_buffer, 0, (size_t)device.buffer_frames * sizeof_sample * output_channels);
+
+    void **planes = device.playback_transfer.data();
+    for (int channel = 0; channel < output_channels; ++channel) {
+        planes[channel] = device.output_buffer + (size_t)channel * device.buffer_frames * sizeof_sample;
+    }
+
+    int drain = buffer_size_frames;
+    while (drain > 0) {
+        int ret;
+        if (mmap_access) {
+            ret = planar_access ? backend->mmap_writen(device.playback, planes, drain) : backend->mmap_writei(device.playback, device.output_buffer, drain);
+        }
+        else {
+            ret = planar_access ? backend->writen(device.playback, planes, drain) : backend->writei(device.playback, device.output_buffer, drain);
+        }
+        if (ret < 0) { return ret; }
+
+        if (verbose) { fprintf(stderr, "Wrote: %d frames\n", ret); }
+
+        drain -= ret;
+        waits.transferred[0] += ret;
+    }
+    return 0;
+}
+
+// Recovers the device from an xrun detected at time with err, starts over
+// from the prefill and logs it. Returns 0 or a negative error code.
+static int recover_from_xrun(pcm_device &device, wait_context &waits, const timespec &time, int err, int &fill, int &drain, const xrun_history &history) {
+    const int64_t start_ns = wait_now_ns();
+    const int directions = xrun_directions(device);
+
+    int ret = recover_pcm_device(device, err);
+    if (ret < 0) { return ret; }
+
+    device.ring.reset();
+    for (int index = 0; index < waits.num_pcms; ++index) {
+        waits.transferred[index] = 0;
+        waits.dlls[index].reset();
+    }
+    fill = 0;
+    drain = buffer_size_frames;
+
+    ret = prefill_playback(device, waits);
+    if (ret < 0) { return ret; }
+
+    // no wakeup interval across the gap
+    thread_stats[device.index].has_previous_wakeup = false;
+
+    log_xrun(device, time, directions, wait_now_ns() - start_ns, history);
+    return 0;
+}
+
+// Samples one set up device until it has collected sample_size samples,
+// failed or a stop was requested. Runs on the thread of the device.
+static void *measure_pcm_device(void *arg) {
+    pcm_device &device = *(pcm_device*)arg;
+    pcm_handle *const playback_pcm = device.playback;
+    pcm_handle *const capture_pcm = device.capture;
+    spsc_ringbuffer &ring = device.ring;
+    int ret;
+
+    // #################### wait setup
+    wait_context waits;
+    pcm_handle *const pcms[] = { playback_pcm, capture_pcm };
+    const snd_pcm_stream_t streams[] = { SND_PCM_STREAM_PLAYBACK, SND_PCM_STREAM_CAPTURE };
+    phase_timer timer;
+    timer.enabled = phase_timing;
+    setup_wait_context(waits, 2, pcms, streams, device.index, &timer);
+    perf_counters counters;
+    rusage usage_start;
+
+    // #################### prefill output buffer
+    int fill = 0;
+    int drain = 0;
+    int avail_playback = 0;
+    int avail_capture = 0;
+    xrun_history history;
+
+    const cycle_engine_functions engine = select_cycle_engine();
+    if (verbose) { fprintf(stderr, "Using %s cycle engine\n", engine.channels ? "specialized" : "generic"); }
+
+    // the split threads start before the prefill starts the devices
+    if (num_threads == 2) { start_split_threads(device, engine); }
+
+    ret = prefill_playback(device, waits);
+    if (ret < 0) {
+        fprintf(stderr, "Error: snd_pcm_writei: %s\n", snd_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t cycles = 0;
+    int sample_index = 0;
+    if (verbose) { fprintf(stderr, "Starting to sample...\n"); }
+
+    if (num_threads == 2) {
+        run_split_threads();
+        goto done;
+    }
+
+    if (perf_counters_enabled) {
+        counters.open();
+        counters.start();
+    }
+    getrusage(RUSAGE_THREAD, &usage_start);
+    attach_live_thread(device.index);
+
+    while(true) {
+        if (stop_requested) {
+            goto done;
+        }
+
+        data data_sample;
+        data_sample.device = device.index;
+
+        timer.start();
+        clock_gettime(CLOCK_MONOTONIC, &data_sample.wakeup_time);
+
+        snd_pcm_state_t state;
+
+        state = backend->state(playback_pcm);
+        if (state == SND_PCM_STATE_XRUN && !xrun_recovery) {
+            fprintf(stderr, "Error: playback xrun on %s\n", device.name.c_str());
+            goto done;
+        }
+
+        state = (state == SND_PCM_STATE_XRUN) ? state : backend->state(capture_pcm);
+        if (state == SND_PCM_STATE_XRUN && !xrun_recovery) {
+            fprintf(stderr, "Error: capture xrun on %s\n", device.capture_name.c_str());
+            goto done;
+        }
+
+        if (state == SND_PCM_STATE_XRUN) {
+            ret = recover_from_xrun(device, waits, data_sample.wakeup_time, -EPIPE, fill, drain, history);
+            if (ret < 0) {
+                fprintf(stderr, "Error: xrun recovery on %s: %s\n", device.name.c_str(), snd_strerror(ret));
+                goto done;
+            }
+            continue;
+        }
+       
+
+        // WAIT
+
+        snd_pcm_sframes_t avail[2];
+        unsigned short revents[2];
+
+        timer.mark(phase_state);
+        ret = strategy->wait(waits, avail, revents);
+        timer.mark(phase_wait);
+        if (ret == -EINTR) {
+            goto done;
+        }
+
+        if (ret < 0) {
+            fprintf(stderr, "Error: wait: %s\n", snd_strerror(ret));
+            break;
+        }
+
+        const int64_t woken_ns = wait_now_ns();
+
+        // DRIVER TIMESTAMPS
+
+        if (driver_timestamps) {
+            ret = record_driver_status(data_sample, woken_ns, device.index, pcms, streams, 2);
+            timer.mark(phase_state);
+            if (ret < 0) {
+                fprintf(stderr, "Error: snd_pcm_status: %s. frame: %d\n", snd_strerror(ret), sample_index);
+                goto done;
+            }
+        }
+
+        if (revents[0] & POLLOUT) {
+            data_sample.poll_pollout = 1;
+        }
+
+        if (revents[1] & POLLIN) {
+            data_sample.poll_pollin = 1;
+        }
+
+        // UPDATE AVAILABLE FRAMES
+
+        avail_capture = avail[1];
+        data_sample.capture_available = avail_capture;
+
+        avail_playback = avail[0];
+        data_sample.playback_available = avail_playback;
+
+        if (xrun_recovery && (is_xrun_error(avail_capture) || is_xrun_error(avail_playback))) {
+            ret = recover_from_xrun(device, waits, data_sample.wakeup_time, is_xrun_error(avail_playback) ? avail_playback : avail_capture, fill, drain, history);
+            if (ret < 0) {
+                fprintf(stderr, "Error: xrun recovery on %s: %s\n", device.name.c_str(), snd_strerror(ret));
+                goto done;
+            }
+            continue;
+        }
+
+        if (avail_capture < 0) {
+            fprintf(stderr, "Error: avail_capture: %s. frame: %d\n", snd_strerror(avail_capture), sample_index);
+            goto done;
+        }
+
+        if (avail_playback < 0) {
+            fprintf(stderr, "Error: avail_playback: %s. frame: %d\n", snd_strerror(avail_playback), sample_index);
+            goto done;
+        }
+
+        // GRAB FRAMES IF ANY ARE AVAILABLE
+
+        if (avail_capture > 0) {
+            int frames_to_read = std::min(std::min(period_size_frames * num_periods - fill, avail_capture), ring.writable());
+            int frames_read = engine.capture(device, frames_to_read, timer);
+            if (xrun_recovery && is_xrun_error(frames_read)) {
+                ret = recover_from_xrun(device, waits, data_sample.wakeup_time, frames_read, fill, drain, history);
+                if (ret < 0) {
+                    fprintf(stderr, "Error: xrun recovery on %s: %s\n", device.name.c_str(), snd_strerror(ret));
+                    goto done;
+                }
+                continue;
+            }
+            if (frames_read < 0) {
+                fprintf(stderr, "Error: capture: %s. frame: %d\n", snd_strerror(frames_read), sample_index);
+                goto done;
+            }
+
+            if (roundtrip_signal != roundtrip_none) { roundtrip_tap(ring, frames_read); }
+
+            data_sample.capture_read = frames_read;
+            fill += frames_read;
+            waits.transferred[1] += frames_read;
+        }
+
+        // Simulate cpu loading when we have enough frames for a processing period
+        timer.mark(phase_other);
+        while (fill >= processing_buffer_frames) {
+            apply_load(device);
+            timer.mark(phase_load);
+
+            ring.publish(processing_buffer_frames);
+            fill -= processing_buffer_frames;
+            drain += processing_buffer_frames;
+        }
+ 
+        if (drain > 0) {
+   
+            if (avail_playback > 0)  {
+                int frames_to_write = std::min(drain, avail_playback);
+                if (roundtrip_signal != roundtrip_none) { roundtrip_inject(ring, waits.transferred[0], frames_to_write); }
+                timer.mark(phase_other);
+                int frames_written = engine.playback(device, frames_to_write, timer);
+                if (xrun_recovery && is_xrun_error(frames_written)) {
+                    ret = recover_from_xrun(device, waits, data_sample.wakeup_time, frames_written, fill, drain, history);
+                    if (ret < 0) {
+                        fprintf(stderr, "Error: xrun recovery on %s: %s\n", device.name.c_str(), snd_strerror(ret));
+                        goto done;
+                    }
+                    continue;
+                }
+                if (frames_written < 0) {
+                    fprintf(stderr, "Error: playback: %s. frame: %d\n", snd_strerror(frames_written), sample_index);
+                    goto done;
+                }
+                data_sample.playback_written = frames_written;
+                drain -= frames_written;
+                waits.transferred[0] += frames_written;
+            }
+        }
+
+        data_sample.io_ns = wait_now_ns() - woken_ns;
+
+        data_sample.cycles = cycles;
+
+        ++cycles;
+
+        data_sample.drain = drain;
+        data_sample.fill = fill;
+        history.record(data_sample);
+
+        if (data_sample.playback_written == 0 && data_sample.capture_read == 0) {
+            usleep(busy_sleep_us);
+            continue;
+        }
+  
+        data_sample.valid = 1;
+        timer.finish(data_sample.phase_ns);
+        if (perf_counters_enabled) { counters.sample(data_sample.perf_deltas); }
+
+        if (print_summary_stats || summary_interval_s > 0) {
+            thread_stats[device.index].record(data_sample);
+            if (phase_timing) { thread_phase_stats[device.index].record(data_sample); }
+            if (perf_counters_enabled) { thread_perf_stats[device.index].record(data_sample); }
+        }
+        live_record(device.index, data_sample, device_xruns[device.index].count);
+
+        if (stream_samples) {
+            sample_stream_push(sample_streams[device.index], data_sample);
+        }
+        else if (print_table) {
+            sample_stores[device.index].push(data_sample);
+        }
+
+        ++sample_index;
+        if (sample_size && sample_index >= sample_size) {
+            goto done;
+        }
+    }
+
+    done: 
+
+    if (num_threads == 1) {
+        rusage usage_end;
+        getrusage(RUSAGE_THREAD, &usage_end);
+        thread_minor_faults[device.index] = usage_end.ru_minflt - usage_start.ru_minflt;
+    }
+
+    release_wait_context(waits);
+    return NULL;
+}
+
+// Configures the open devices for the current parameters, runs one
+// measurement on all of them at once and writes its table and summary.
+void run_measurement() {
+    int ret;
+
+    rewind_arena();
+
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        pcm_device &device = pcm_devices[index];
+
+        if (verbose) { fprintf(stderr, "Setting up playback device %s...\n", device.name.c_str()); }
+
+        ret = backend->setup(device.playback, output_channels);
+        if (ret != 0) {
+            fprintf(stderr, "Error: setup_pcm_device: Failed to setup playback device %s\n", device.name.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        if (verbose) { fprintf(stderr, "Setting up capture device %s...\n", device.capture_name.c_str()); }
+
+        ret = backend->setup(device.capture, input_channels);
+        if (ret != 0) {
+            fprintf(stderr, "Error: setup_pcm_device: Failed to setup capture device %s\n", device.capture_name.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        // #################### alsa pcm device linking
+        ret = backend->link(device.playback, device.capture);
+        if (ret < 0) {
+            fprintf(stderr, "Error: snd_pcm_link %s: %s\n", device.name.c_str(), snd_strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+
+        device.ring.allocate(buffer_size_frames, min_channels, planar_access);
+    }
+
+    reset_thread_stats();
+    reset_clock_estimates();
+    reset_xrun_stats();
+    setup_sample_stores(num_sampling_threads(), (print_table && !stream_samples) ? sample_size : 0, device_buffer_frames);
+    if (verbose) { fprintf(stderr, "Storing samples in %zu bytes\n", sample_stores_bytes()); }
+
+    if (load_type == load_dsp) {
+        calibrate_dsp_load();
+        if (verbose) { print_dsp_load(stderr); }
+    }
+
+    run_baseline_pass();
+
+    if (roundtrip_signal != roundtrip_none) { start_roundtrip(roundtrip_signal); }
+    start_corunners();
+    start_baseline();
+
+    rusage usage_start, usage_end;
+    getrusage(RUSAGE_SELF, &usage_start);
+    const int64_t start_ns = wait_now_ns();
+
+    if (xrun_recovery) { start_xrun_logger(); }
+    run_pcm_device_threads(measure_pcm_device);
+    if (xrun_recovery) { stop_xrun_logger(); }
+
+    stop_baseline();
+    stop_corunners();
+
+    getrusage(RUSAGE_SELF, &usage_end);
+    const int64_t wall_ns = wait_now_ns() - start_ns;
+
+    if (verbose) { fprintf(stderr, "Done sampling...\n"); } 
+
+    if (roundtrip_signal != roundtrip_none) { stop_roundtrip(); }
+
+    if (print_table && !stream_samples) {
+        output_header(output);
+
+        output_sample_stores(output);
+
+        output_finish(output);
+    }
+
+    if (print_summary_stats) {
+        print_summary(stderr);
+        print_baseline_summary(stderr);
+        print_thread_minor_faults(stderr);
+        print_resource_usage(stderr, usage_start, usage_end, wall_ns);
+        if (xrun_recovery) { print_xrun_stats(stderr, wall_ns); }
+        if (driver_timestamps) { print_clock_estimates(stderr); }
+        if (load_type == load_dsp) { print_dsp_load(stderr); }
+        print_corunner_summary(stderr);
+        if (roundtrip_signal != roundtrip_none) { print_roundtrip_summary(stderr); }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    namespace po = boost::program_options;
+
+    const int64_t startup_start_ns = wait_now_ns();
+
+    po::options_description options_desc("Options");
+    options_desc.add_options()
+        ("help,h", "produce this help message")
+        ("verbose,v", po::value<int>(&verbose)->default_value(0), "whether to be a little more verbose")
+        ("period-size,p", po::value<int>(&period_size_frames)->default_value(1024), "period size (audio frames)")
+        ("number-of-periods,n", po::value<int>(&num_periods)->default_value(2), "number of periods")
+        ("rate,r", po::value<int>(&sampling_rate_hz)->default_value(48000), "sampling rate (hz)")
+        ("pcm-device-name,d", po::value<std::vector<std::string>>(&pcm_device_names)->default_value(std::vector<std::string>(1, "default"), "default"), "the ALSA pcm device name string. Repeat to measure several devices at once, each on its own thread")
+        ("capture-pcm-device-name", po::value<std::vector<std::string>>(&capture_pcm_device_names), "the ALSA pcm device name string of the capture device, once per --pcm-device-name, e.g. hw:Loopback,1 to capture what hw:Loopback,0 plays (default: --pcm-device-name)")
+        ("cpu", po::value<std::vector<int>>(&device_cpus), "the cpu to pin the thread of each device to, once per --pcm-device-name (-1: not pinned)")
+        ("irq-affinity", po::value<int>(&irq_affinity)->default_value(0), "whether to also move the interrupt of the card of each pinned device and its irq thread to the cpu of the device (needs root)")
+        ("input-channels,i", po::value<int>(&input_channels)->default_value(2), "the number of input channels")
+        ("output-channels,o", po::value<int>(&output_channels)->default_value(2), "the number of output channels")
+        ("priority,P", po::value<int>(&priority)->default_value(70), "SCHED_FIFO priority")
+        ("sample-size,s", po::value<int>(&sample_size)->default_value(1000), "the number of samples to collect for stats (might be less due how to alsa works). 0: until interrupted, requires --stream 1")
+        ("sample-format,f", po::value<std::string>(&sample_format_name)->default_value("S32LE"), "the sample format. Available formats: S16LE, S24LE (24 bits in 32), S24_3LE (24 bits in 3 bytes), S32LE, FLOATLE, auto (the cheapest to convert that the hardware of all devices supports)")
+        ("access,A", po::value<std::string>(&access_mode)->default_value("rw"), "the pcm access mode. Available modes: rw, mmap, rw-planar, mmap-planar (non-interleaved, with a planar ringbuffer)")
+        ("show-header,e", po::value<int>(&show_header)->default_value(1), "whether to show a header in the output table")
+        ("wait,w", po::value<std::string>(&wait_strategy_name)->default_value("poll"), "how to wait for the devices. Available strategies: poll, epoll, spin, usleep (sleep --busy microseconds between checks), hybrid (spin, then poll), tsched (timer scheduling without period wakeups)")
+        ("hybrid-max-spin", po::value<int>(&hybrid_max_spin_us)->default_value(100), "the maximum number of microseconds the hybrid strategy spins before blocking")
+        ("phase-timing", po::value<int>(&phase_timing)->default_value(0), "whether to time the phases of every cycle (state, wait, revents, avail, read, convert-in, load, convert-out, write, other) into extra columns and summaries")
+        ("perf-counters", po::value<int>(&perf_counters_enabled)->default_value(0), "whether to count instructions, cycles, llc-misses, ctx-switches, migrations and page-faults of the sampling threads per sample into extra columns and summaries (perf_event_open)")
+        ("xrun-recovery", po::value<int>(&xrun_recovery)->default_value(0), "whether to recover from xruns, log them and keep sampling instead of ending the measurement at the first one")
+        ("driver-timestamps", po::value<int>(&driver_timestamps)->default_value(1), "whether to query the pcm status of the devices every cycle for the delay and hw-lag columns and the clock drift estimates")
+        ("tsched-buffer-size", po::value<int>(&tsched_buffer_frames)->default_value(16384), "the hardware buffer size of the tsched strategy (audio frames). The latency stays period-size * number-of-periods")
+        ("busy,b", po::value<int>(&busy_sleep_us)->default_value(1), "the number of microseconds to sleep everytime when nothing was done and between checks of the usleep strategy")
+        ("prefault-heap-size,a", po::value<int>(&prefault_heap_size_mb)->default_value(16), "the number of megabytes of heap space to prefault, for what doesn't come from the run arena")
+        ("hugepages", po::value<int>(&hugepages)->default_value(0), "whether to map the run arena, which holds the sample buffers and tables, on huge pages")
+        ("processing-buffer-size,c", po::value<int>(&processing_buffer_frames)->default_value(-1), "the processing buffer size (audio frames)")
+        ("load,l", po::value<int>(&sleep_percent)->default_value(0), "the percentage of the real time duration of a processing buffer to spend processing it")
+        ("load-type", po::value<std::string>(&load_type_name)->default_value("sleep"), "how to spend the --load. Available types: sleep (nanosleep), dsp (run the --dsp-chain over the frames, calibrated on this cpu)")
+        ("dsp-chain", po::value<std::string>(&dsp_chain_spec)->default_value("fir:64,biquad:4,fft:256"), "the comma separated stages of the dsp load: fir:<taps>, biquad:<sections>, fft:<size>")
+        ("threads,t", po::value<int>(&num_threads)->default_value(1), "the number of sampling threads. 1: capture and playback in one thread, 2: capture and playback in separate threads")
+        ("stream,S", po::value<int>(&stream_samples)->default_value(0), "whether to stream the samples to the output while sampling instead of collecting them until the end")
+        ("stream-queue-size", po::value<int>(&stream_queue_size)->default_value(65536), "the number of samples the queue between a sampling thread and the writer thread holds")
+        ("output,O", po::value<std::string>(&output_file_name)->default_value("-"), "the file to write the sample table to (-: stdout)")
+        ("output-format,F", po::value<std::string>(&output_format)->default_value("text"), "the output format. Available formats: text, binary (convert with alsa-pcm-stats-convert)")
+        ("table,T", po::value<int>(&print_table)->default_value(1), "whether to print the per sample table")
+        ("summary,u", po::value<int>(&print_summary_stats)->default_value(1), "whether to print summary statistics to stderr at the end")
+        ("summary-interval", po::value<int>(&summary_interval_s)->default_value(0), "the number of seconds between periodic summaries on stderr (0: none)")
+        ("live-stats", po::value<std::string>(&live_stats_name)->default_value(""), "the name of a shared memory segment (/dev/shm/<name>) to publish live stats to for alsa-pcm-stats-top (empty: none)")
+        ("conversion-kernels,k", po::value<std::string>(&conversion_kernels_name)->default_value("auto"), "the sample conversion kernels. Available kernels: auto, scalar, sse2, avx2, avx512")
+        ("benchmark-conversion", po::value<int>(&conversion_benchmark)->default_value(0), "whether to only benchmark the sample conversion kernels and exit")
+        ("backend", po::value<std::string>(&backend_name)->default_value("alsa"), "the pcm backend. Available backends: alsa, sim (a simulated device driven by CLOCK_MONOTONIC, no sound hardware needed)")
+        ("sim-jitter", po::value<int>(&sim_jitter_us)->default_value(0), "the maximum lateness of the period boundaries of the sim backend (microseconds)")
+        ("sim-xrun-interval", po::value<int>(&sim_xrun_interval)->default_value(0), "the number of periods between injected xruns of the sim backend (0: none)")
+        ("sim-drift", po::value<double>(&sim_drift_ppm)->default_value(0), "how much faster the clock of the sim backend runs than CLOCK_MONOTONIC (ppm)")
+        ("sim-loopback", po::value<int>(&sim_loopback_frames)->default_value(-1), "the number of frames after which the sim backend captures what it played, like a loopback cable (-1: capture silence)")
+        ("roundtrip,R", po::value<std::string>(&roundtrip_signal_name)->default_value("none"), "the test signal to play and find in the captured frames for the round trip latency instead of passing the captured frames through. Available signals: none, impulse, mls, chirp")
+        ("roundtrip-interval", po::value<int>(&roundtrip_interval_frames)->default_value(0), "the number of frames between the starts of the test signals, which must exceed the latency plus the signal length (0: one second)")
+        ("roundtrip-length", po::value<int>(&roundtrip_signal_frames)->default_value(4096), "the length of the mls and chirp test signals (audio frames). mls uses the longest sequence that fits")
+        ("roundtrip-channel", po::value<int>(&roundtrip_channel)->default_value(0), "the channel to play the test signal on and look for it in")
+        ("corunner", po::value<std::vector<std::string>>(&corunner_specs), "a thread that interferes with the measurement, repeatable: kind[:key=value,...]. Kinds: membw (memory bandwidth), cache (last level cache thrashing), syscall (a syscall storm), pagefault (minor faults). Keys: cpu, policy (other, batch, idle, fifo, rr), priority, size (working set, K/M/G suffixes), on and off (phase lengths in ms, default 1000, off=0: always on). Phase starts are written into the sample output")
+        ("baseline", po::value<std::string>(&baseline_mode_name)->default_value("off"), "a clock_nanosleep thread with the priority and period of the sampling threads whose wakeup error is summarized next to theirs. Available modes: off, parallel (during the measurement), before (alone, for as long as the measurement, before it)")
+        ("baseline-cpu", po::value<int>(&baseline_cpu)->default_value(-1), "the cpu to pin the baseline thread to, best a sibling of the sampling cpu (-1: not pinned)")
+        ("sweep,W", po::value<int>(&sweep)->default_value(0), "whether to run one measurement for every combination of the --sweep-* values in one process. --output is then the prefix of one file per measurement")
+        ("sweep-period-size", po::value<std::string>(&sweep_period_sizes), "the period sizes to sweep: comma separated values and first:last[:step] ranges, a step xN multiplies (default: --period-size)")
+        ("sweep-number-of-periods", po::value<std::string>(&sweep_num_periods), "the numbers of periods to sweep (default: --number-of-periods)")
+        ("sweep-processing-buffer-size", po::value<std::string>(&sweep_processing_buffer_sizes), "the processing buffer sizes to sweep (default: --processing-buffer-size)")
+        ("sweep-load", po::value<std::string>(&sweep_loads), "the loads to sweep (default: --load)")
+        ("sweep-repetitions", po::value<int>(&sweep_repetitions)->default_value(1), "how often to repeat the whole sweep")
+        ("sweep-seconds", po::value<int>(&sweep_seconds)->default_value(0), "the length of every measurement of a sweep in seconds (0: --sample-size samples)")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, options_desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cout << options_desc << "\n";
+        exit(EXIT_SUCCESS);
+    }
+
+    if (output_format != "text" && output_format != "binary") {
+        fprintf(stderr, "Error: unsupported output format: %s\n", output_format.c_str());
+        exit(EXIT_FAILURE);
+    }
+    binary_output = (output_format == "binary");
+
+    if (sweep && binary_output && output_file_name == "-") {
+        fprintf(stderr, "Error: a binary sweep requires --output.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    output = stdout;
+    if (!sweep && output_file_name != "-") {
+        output = fopen(output_file_name.c_str(), "w");
+        if (!output) {
+            fprintf(stderr, "Error: fopen %s: %s\n", output_file_name.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    backend = find_pcm_backend(backend_name);
+    if (!backend) {
+        fprintf(stderr, "Error: unsupported backend: %s\n", backend_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    strategy = find_wait_strategy(wait_strategy_name);
+    if (!strategy) {
+        fprintf(stderr, "Error: unsupported wait strategy: %s\n", wait_strategy_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+    tsched = (strategy->wait == wait_tsched);
+
+    kernels = find_conversion_kernels(conversion_kernels_name);
+    if (!kernels) {
+        fprintf(stderr, "Error: unsupported conversion kernels: %s\n", conversion_kernels_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    if (verbose) { fprintf(stderr, "Using %s conversion kernels\n", kernels->name); }
+
+    if (conversion_benchmark) {
+        benchmark_conversion();
+        exit(EXIT_SUCCESS);
+    }
+
+    int ret;
+
+    if (verbose) { fprintf(stderr, "Tuning memory allocator...\n"); }
+    ret = mallopt(M_MMAP_MAX, 0);
+    if (ret != 1) {
+        fprintf(stderr, "Error: mallopt M_MMAP_MAX: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    ret = mallopt(M_TRIM_THRESHOLD, -1);
+    if (ret != 1) {
+        fprintf(stderr, "Error: mallopt M_TRIM_THRESHOLD: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    if (verbose) { fprintf(stderr, "Locking memory...\n"); }
+    ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (ret != 0) {
+        fprintf(stderr, "Error: mlockall: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+  
+    if (verbose) { fprintf(stderr, "Prefaulting heap memory...\n"); }
+    char *dummy_heap = (char*)malloc(1024 * 1024 * prefault_heap_size_mb);
+    if (!dummy_heap) {
+        fprintf(stderr, "Failed to allocate prefaulting heap memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int index = 0; index < (1024 * 1024 * prefault_heap_size_mb); index += page_bytes) {
+        dummy_heap[index] = 1;
+    }
+
+    free(dummy_heap);
+
+    if (verbose) { fprintf(stderr, "Prefaulting stack memory...\n"); }
+    {
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+        unsigned char dummy_stack[1024 * 1024];
+        for (int index = 0; index < (1024 * 1024); index += page_bytes) {
+            dummy_stack[index] = 1;
+        }
+        #pragma GCC diagnostic pop
+    } 
+
+    setup_sweep(sweep, sweep_period_sizes, sweep_num_periods, sweep_processing_buffer_sizes, sweep_loads, sweep_repetitions, sweep_seconds);
+
+    if (sample_size < 0 || (sample_size == 0 && print_table && !stream_samples)) {
+        fprintf(stderr, "Error: a sample size of 0 (unbounded) requires --stream 1 or --table 0.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (stream_samples && !print_table) {
+        fprintf(stderr, "Error: --stream 1 requires --table 1.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (sweep && stream_samples) {
+        fprintf(stderr, "Error: --sweep 1 does not support --stream 1.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (num_threads != 1 && num_threads != 2) {
+        fprintf(stderr, "Error: the number of threads must be 1 or 2.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (access_mode != "rw" && access_mode != "mmap" && access_mode != "rw-planar" && access_mode != "mmap-planar") {
+        fprintf(stderr, "Error: unsupported access mode: %s\n", access_mode.c_str());
+        exit(EXIT_FAILURE);
+    }
+    mmap_access = (access_mode == "mmap" || access_mode == "mmap-planar");
+    planar_access = (access_mode == "rw-planar" || access_mode == "mmap-planar");
+    min_channels = std::min(input_channels, output_channels);
+
+    roundtrip_signal = find_roundtrip_signal(roundtrip_signal_name);
+    if (roundtrip_signal < 0) {
+        fprintf(stderr, "Error: unsupported round trip signal: %s\n", roundtrip_signal_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    if (load_type_name == "sleep") {
+        load_type = load_sleep;
+    }
+    else if (load_type_name == "dsp") {
+        load_type = load_dsp;
+        setup_dsp_chain(dsp_chain_spec);
+        setup_dsp_float_mode();
+    }
+    else {
+        fprintf(stderr, "Error: unsupported load type: %s\n", load_type_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    if (phase_timing) { setup_phase_clock(); }
+    if (perf_counters_enabled) { setup_perf_counters(); }
+
+    setup_baseline(baseline_mode_name);
+    setup_corunners(corunner_specs);
+    allocate_corunners();
+
+    setup_pcm_devices(pcm_device_names, capture_pcm_device_names, device_cpus);
+
+    if (xrun_recovery && num_threads != 1) {
+        fprintf(stderr, "Error: --xrun-recovery requires --threads 1.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (num_pcm_devices > 1 && num_threads != 1) {
+        fprintf(stderr, "Error: several devices require --threads 1.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (roundtrip_interval_frames == 0) { roundtrip_interval_frames = sampling_rate_hz; }
+    if (roundtrip_signal != roundtrip_none) {
+        if (num_pcm_devices > 1) {
+            fprintf(stderr, "Error: --roundtrip supports a single device.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (roundtrip_channel < 0 || roundtrip_channel >= min_channels) {
+            fprintf(stderr, "Error: --roundtrip-channel must be below the input and output channel counts.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (roundtrip_signal_frames < 1 || roundtrip_interval_frames <= roundtrip_signal_frames) {
+            fprintf(stderr, "Error: --roundtrip-interval must exceed --roundtrip-length.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    setup_sample_format(sample_format_name);
+
+    const int max_buffer_size_frames = sweep_max_buffer_size_frames();
+    const int max_device_buffer_frames = tsched ? std::max(tsched_buffer_frames, max_buffer_size_frames) : max_buffer_size_frames;
+
+    // #################### run arena
+    size_t fixed_bytes = pcm_device_buffers_bytes(max_buffer_size_frames);
+    if (binary_output) { fixed_bytes += arena_round(trace_batch_bytes); }
+    if (stream_samples) { fixed_bytes += num_sampling_threads() * spsc_queue<data>::bytes_for(stream_queue_size); }
+    if (xrun_recovery) { fixed_bytes += xrun_logs_bytes(); }
+
+    size_t measurement_bytes = num_pcm_devices * spsc_ringbuffer::bytes_for(max_buffer_size_frames, min_channels);
+    if (roundtrip_signal != roundtrip_none) { measurement_bytes += spsc_ringbuffer::bytes_for(std::max(4 * roundtrip_interval_frames, 4 * sampling_rate_hz), 1); }
+    if (print_table && !stream_samples) { measurement_bytes += num_sampling_threads() * sample_store::bytes_for(sweep_max_sample_size(), max_device_buffer_frames); }
+
+    setup_arena(fixed_bytes, measurement_bytes, hugepages);
+    if (verbose) { fprintf(stderr, "Mapped a run arena of %zu bytes on %s pages\n", arena.bytes, arena.hugepages ? "huge" : "normal"); }
+
+    allocate_pcm_device_buffers(max_buffer_size_frames);
+    if (xrun_recovery) { allocate_xrun_logs(); }
+
+    if (verbose) { fprintf(stderr, "Setting SCHED_FIFO at priority: %d\n", priority); }
+
+    // #################### scheduling and priority setup
+    struct sched_param pthread_params;
+    pthread_params.sched_priority = priority;
+    ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &pthread_params);
+    if (ret != 0) {
+        fprintf(stderr, "Error: setschedparam: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    setup_output();
+    install_stop_handler();
+
+    setup_thread_stats();
+    setup_live_stats();
+
+    if (summary_interval_s > 0) {
+        start_summary_reporter(summary_interval_s);
+    }
+
+    if (stream_samples) {
+        if (verbose) { fprintf(stderr, "Starting stream writer thread...\n"); }
+        start_stream_writer(output, num_sampling_threads(), stream_queue_size);
+    }
+
+    // #################### alsa pcm device open
+    open_pcm_devices();
+
+    if (irq_affinity) {
+        pin_pcm_device_irqs();
+    }
+
+    if (print_summary_stats) {
+        fprintf(stderr, "startup: %.1f ms, run arena %zu bytes on %s pages\n", (wait_now_ns() - startup_start_ns) * 1e-6, arena.bytes, arena.hugepages ? "huge" : "normal");
+    }
+
+    for (size_t point_index = 0; point_index < sweep_points.size() && !stop_requested; ++point_index) {
+        const sweep_point &point = sweep_points[point_index];
+        apply_sweep_point(point);
+
+        if (sweep) {
+            fprintf(stderr, "Sweep point %zu/%zu: ", point_index + 1, sweep_points.size());
+            print_sweep_point(stderr, point);
+
+            if (point_index > 0) {
+                for (int index = 0; index < num_pcm_devices; ++index) {
+                    release_pcm_devices(pcm_devices[index].playback, pcm_devices[index].capture);
+                }
+            }
+
+            if (output_file_name == "-") {
+                if (print_table) {
+                    fprintf(output, "# ");
+                    print_sweep_point(output, point);
+                }
+            }
+            else {
+                std::string point_file_name = sweep_output_file_name(output_file_name, point);
+                output = fopen(point_file_name.c_str(), "w");
+                if (!output) {
+                    fprintf(stderr, "Error: fopen %s: %s\n", point_file_name.c_str(), strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+
+        start_live_measurement(point_index + 1, sweep_points.size());
+        run_measurement();
+        stop_live_measurement();
+
+        if (sweep && output != stdout) {
+            fclose(output);
+            output = stdout;
+        }
+    }
+
+    if (summary_interval_s > 0) {
+        stop_summary_reporter();
+    }
+
+    if (stream_samples) {
+        stop_stream_writer();
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    finish_live_stats();
+
+    // delete[] buffer;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// #################### run memory arena
+//
+// The per-frame and per-sample buffers of a run all come from one mapping
+// that is sized from the parameters up front and mapped with
+// MAP_POPULATE | MAP_LOCKED, optionally on huge pages. After that single
+// mmap they are resident and locked, instead of being touched page by
+// page, and they share as few TLB entries as possible. Allocations are
+// never freed one by one: the fixed part holds what lives for the whole
+// run, and the measurement part behind it is rewound at the start of
+// every measurement of a sweep. Before setup_arena, for the conversion
+// benchmark, allocations come from the heap.
+
+const size_t page_bytes = sysconf(_SC_PAGESIZE);
+const size_t arena_alignment = 64;
+const size_t arena_huge_page_bytes = 2 * 1024 * 1024;
+
+struct run_arena {
+    uint8_t *base;
+    size_t bytes;
+    size_t used;
+    // where the measurement part starts
+    size_t measurement_start;
+    bool hugepages;
+};
+
+run_arena arena = { nullptr, 0, 0, 0, false };
+
+// What an allocation of bytes takes from the arena.
+static inline size_t arena_round(size_t bytes) {
+    return (bytes + arena_alignment - 1) / arena_alignment * arena_alignment;
+}
+
+// Maps fixed_bytes for the whole run plus measurement_bytes for every
+// measurement, on huge pages if asked for and available.
+void setup_arena(size_t fixed_bytes, size_t measurement_bytes, bool hugepages) {
+    const size_t bytes = fixed_bytes + measurement_bytes;
+    arena.measurement_start = fixed_bytes;
+    arena.used = 0;
+    arena.hugepages = false;
+
+    void *mapped = MAP_FAILED;
+    if (hugepages) {
+        arena.bytes = (bytes + arena_huge_page_bytes - 1) / arena_huge_page_bytes * arena_huge_page_bytes;
+        mapped = mmap(NULL, arena.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_LOCKED | MAP_HUGETLB, -1, 0);
+        if (mapped == MAP_FAILED) {
+            fprintf(stderr, "Warning: mmap of %zu bytes of huge pages: %s, using normal pages\n", arena.bytes, strerror(errno));
+        }
+        else {
+            arena.hugepages = true;
+        }
+    }
+
+    if (mapped == MAP_FAILED) {
+        arena.bytes = (bytes + page_bytes - 1) / page_bytes * page_bytes;
+        mapped = mmap(NULL, arena.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_LOCKED, -1, 0);
+        if (mapped == MAP_FAILED) {
+            fprintf(stderr, "Error: mmap of the %zu byte run arena: %s\n", arena.bytes, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    arena.base = (uint8_t*)mapped;
+}
+
+// Zeroed, cache line aligned memory for the rest of the run, or until the
+// next rewind if allocated in the measurement part.
+void *arena_allocate(size_t bytes) {
+    if (!arena.base) {
+        void *memory = aligned_alloc(arena_alignment, arena_round(bytes));
+        if (!memory) {
+            fprintf(stderr, "Error: failed to allocate %zu bytes\n", bytes);
+            exit(EXIT_FAILURE);
+        }
+        memset(memory, 0, arena_round(bytes));
+        return memory;
+    }
+
+    if (arena.used + arena_round(bytes) > arena.bytes) {
+        fprintf(stderr, "Error: the run arena of %zu bytes is exhausted by %zu more\n", arena.bytes, bytes);
+        exit(EXIT_FAILURE);
+    }
+    void *memory = arena.base + arena.used;
+    arena.used += arena_round(bytes);
+    memset(memory, 0, bytes);
+    return memory;
+}
+
+// Frees memory of arena_allocate that came from the heap. Arena memory
+// is only given back by rewind_arena.
+void arena_release(void *memory) {
+    if (arena.base && (uint8_t*)memory >= arena.base && (uint8_t*)memory < arena.base + arena.bytes) { return; }
+    free(memory);
+}
+
+// Gives the measurement part back for the next measurement. Everything
+// allocated in it is invalid afterwards.
+void rewind_arena() {
+    if (arena.base) { arena.used = arena.measurement_start; }
+}
@@ -0,0 +1,212 @@
+// #################### pcm backends
+//
+// Everything the measurement loops do with a pcm device goes through the
+// pcm_backend selected with --backend, so the same loops run against real
+// ALSA devices or against the simulated device from sim.cc. The functions
+// have the signatures and return values of their snd_pcm_* counterparts.
+
+// Opaque handle: a snd_pcm_t for the alsa backend, a sim_pcm for the
+// simulated one.
+struct pcm_handle;
+
+// The parts of snd_pcm_status_t the measurements use. Timestamps are
+// CLOCK_MONOTONIC (see setup_pcm_device), tstamp is the time of the last
+// hardware pointer update, audio_tstamp the position of the hardware
+// pointer as time since the trigger by the audio clock.
+struct pcm_status {
+    snd_pcm_state_t state;
+    timespec trigger_tstamp;
+    timespec tstamp;
+    timespec audio_tstamp;
+    snd_pcm_sframes_t delay;
+    snd_pcm_uframes_t avail;
+};
+
+struct pcm_backend {
+    const char *name;
+    int (*open)(pcm_handle **pcm, const char *name, snd_pcm_stream_t stream);
+    // Configures the device from the globals like setup_pcm_device.
+    int (*setup)(pcm_handle *pcm, int channels);
+    int (*link)(pcm_handle *pcm1, pcm_handle *pcm2);
+    int (*unlink)(pcm_handle *pcm);
+    int (*drop)(pcm_handle *pcm);
+    // snd_pcm_recover without messages
+    int (*recover)(pcm_handle *pcm, int err);
+    int (*hw_free)(pcm_handle *pcm);
+    snd_pcm_state_t (*state)(pcm_handle *pcm);
+    snd_pcm_sframes_t (*avail)(pcm_handle *pcm);
+    snd_pcm_sframes_t (*avail_update)(pcm_handle *pcm);
+    snd_pcm_sframes_t (*readi)(pcm_handle *pcm, void *buffer, snd_pcm_uframes_t frames);
+    snd_pcm_sframes_t (*writei)(pcm_handle *pcm, const void *buffer, snd_pcm_uframes_t frames);
+    snd_pcm_sframes_t (*mmap_writei)(pcm_handle *pcm, const void *buffer, snd_pcm_uframes_t frames);
+    snd_pcm_sframes_t (*readn)(pcm_handle *pcm, void **buffers, snd_pcm_uframes_t frames);
+    snd_pcm_sframes_t (*writen)(pcm_handle *pcm, void **buffers, snd_pcm_uframes_t frames);
+    snd_pcm_sframes_t (*mmap_writen)(pcm_handle *pcm, void **buffers, snd_pcm_uframes_t frames);
+    int (*mmap_begin)(pcm_handle *pcm, const snd_pcm_channel_area_t **areas, snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames);
+    snd_pcm_sframes_t (*mmap_commit)(pcm_handle *pcm, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames);
+    int (*poll_descriptors_count)(pcm_handle *pcm);
+    int (*poll_descriptors)(pcm_handle *pcm, pollfd *pfds, unsigned int space);
+    int (*poll_descriptors_revents)(pcm_handle *pcm, pollfd *pfds, unsigned int nfds, unsigned short *revents);
+    int (*status)(pcm_handle *pcm, pcm_status *status);
+    // The index of the sound card of the device or a negative error code.
+    int (*card)(pcm_handle *pcm);
+    // The sample formats (bit 1 << sample_format_*) the hardware behind
+    // the device named name supports without conversion, or a negative
+    // error code. Opens and closes the device.
+    int (*native_formats)(const char *name, snd_pcm_stream_t stream);
+};
+
+// ########## alsa
+
+static inline snd_pcm_t *alsa_pcm(pcm_handle *pcm) { return (snd_pcm_t*)pcm; }
+
+static int alsa_open(pcm_handle **pcm, const char *name, snd_pcm_stream_t stream) {
+    snd_pcm_t *alsa;
+    int ret = snd_pcm_open(&alsa, name, stream, SND_PCM_NONBLOCK);
+    *pcm = (pcm_handle*)alsa;
+    return ret;
+}
+
+static int alsa_setup(pcm_handle *pcm, int channels) { return setup_pcm_device(alsa_pcm(pcm), channels); }
+static int alsa_link(pcm_handle *pcm1, pcm_handle *pcm2) { return snd_pcm_link(alsa_pcm(pcm1), alsa_pcm(pcm2)); }
+static int alsa_unlink(pcm_handle *pcm) { return snd_pcm_unlink(alsa_pcm(pcm)); }
+static int alsa_drop(pcm_handle *pcm) { return snd_pcm_drop(alsa_pcm(pcm)); }
+static int alsa_recover(pcm_handle *pcm, int err) { return snd_pcm_recover(alsa_pcm(pcm), err, 1); }
+static int alsa_hw_free(pcm_handle *pcm) { return snd_pcm_hw_free(alsa_pcm(pcm)); }
+static snd_pcm_state_t alsa_state(pcm_handle *pcm) { return snd_pcm_state(alsa_pcm(pcm)); }
+static snd_pcm_sframes_t alsa_avail(pcm_handle *pcm) { return snd_pcm_avail(alsa_pcm(pcm)); }
+static snd_pcm_sframes_t alsa_avail_update(pcm_handle *pcm) { return snd_pcm_avail_update(alsa_pcm(pcm)); }
+static snd_pcm_sframes_t alsa_readi(pcm_handle *pcm, void *buffer, snd_pcm_uframes_t frames) { return snd_pcm_readi(alsa_pcm(pcm), buffer, frames); }
+static snd_pcm_sframes_t alsa_writei(pcm_handle *pcm, const void *buffer, snd_pcm_uframes_t frames) { return snd_pcm_writei(alsa_pcm(pcm), buffer, frames); }
+static snd_pcm_sframes_t alsa_mmap_writei(pcm_handle *pcm, const void *buffer, snd_pcm_uframes_t frames) { return snd_pcm_mmap_writei(alsa_pcm(pcm), buffer, frames); }
+static snd_pcm_sframes_t alsa_readn(pcm_handle *pcm, void **buffers, snd_pcm_uframes_t frames) { return snd_pcm_readn(alsa_pcm(pcm), buffers, frames); }
+static snd_pcm_sframes_t alsa_writen(pcm_handle *pcm, void **buffers, snd_pcm_uframes_t frames) { return snd_pcm_writen(alsa_pcm(pcm), buffers, frames); }
+static snd_pcm_sframes_t alsa_mmap_writen(pcm_handle *pcm, void **buffers, snd_pcm_uframes_t frames) { return snd_pcm_mmap_writen(alsa_pcm(pcm), buffers, frames); }
+static int alsa_mmap_begin(pcm_handle *pcm, const snd_pcm_channel_area_t **areas, snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames) { return snd_pcm_mmap_begin(alsa_pcm(pcm), areas, offset, frames); }
+static snd_pcm_sframes_t alsa_mmap_commit(pcm_handle *pcm, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames) { return snd_pcm_mmap_commit(alsa_pcm(pcm), offset, frames); }
+static int alsa_poll_descriptors_count(pcm_handle *pcm) { return snd_pcm_poll_descriptors_count(alsa_pcm(pcm)); }
+static int alsa_poll_descriptors(pcm_handle *pcm, pollfd *pfds, unsigned int space) { return snd_pcm_poll_descriptors(alsa_pcm(pcm), pfds, space); }
+static int alsa_poll_descriptors_revents(pcm_handle *pcm, pollfd *pfds, unsigned int nfds, unsigned short *revents) { return snd_pcm_poll_descriptors_revents(alsa_pcm(pcm), pfds, nfds, revents); }
+
+static int alsa_status(pcm_handle *pcm, pcm_status *status) {
+    snd_pcm_status_t *alsa_status;
+    snd_pcm_status_alloca(&alsa_status);
+    int ret = snd_pcm_status(alsa_pcm(pcm), alsa_status);
+    if (ret < 0) { return ret; }
+
+    status->state = snd_pcm_status_get_state(alsa_status);
+    snd_pcm_status_get_trigger_htstamp(alsa_status, &status->trigger_tstamp);
+    snd_pcm_status_get_htstamp(alsa_status, &status->tstamp);
+    snd_pcm_status_get_audio_htstamp(alsa_status, &status->audio_tstamp);
+    status->delay = snd_pcm_status_get_delay(alsa_status);
+    status->avail = snd_pcm_status_get_avail(alsa_status);
+    return 0;
+}
+
+static int alsa_card(pcm_handle *pcm) {
+    snd_pcm_info_t *info;
+    snd_pcm_info_alloca(&info);
+    int ret = snd_pcm_info(alsa_pcm(pcm), info);
+    if (ret < 0) { return ret; }
+    return snd_pcm_info_get_card(info);
+}
+
+// Tests the formats on the hw device that the device, maybe a plug or
+// another plugin on top of it, ends up on.
+static int alsa_native_formats(const char *name, snd_pcm_stream_t stream) {
+    snd_pcm_t *alsa;
+    int ret = snd_pcm_open(&alsa, name, stream, SND_PCM_NONBLOCK);
+    if (ret < 0) { return ret; }
+
+    snd_pcm_info_t *info;
+    snd_pcm_info_alloca(&info);
+    ret = snd_pcm_info(alsa, info);
+    const int card = (ret < 0) ? ret : snd_pcm_info_get_card(info);
+    const unsigned int device = (ret < 0) ? 0 : snd_pcm_info_get_device(info);
+    snd_pcm_close(alsa);
+    if (card < 0) { return (ret < 0) ? ret : -ENODEV; }
+
+    char hw_name[32];
+    snprintf(hw_name, sizeof(hw_name), "hw:%d,%u", card, device);
+    ret = snd_pcm_open(&alsa, hw_name, stream, SND_PCM_NONBLOCK);
+    if (ret < 0) { return ret; }
+
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_alloca(&params);
+    ret = snd_pcm_hw_params_any(alsa, params);
+    int formats = 0;
+    for (int format = 0; ret >= 0 && format < trace_num_sample_formats; ++format) {
+        if (snd_pcm_hw_params_test_format(alsa, params, alsa_sample_formats[format]) == 0) { formats |= 1 << format; }
+    }
+    snd_pcm_close(alsa);
+    return (ret < 0) ? ret : formats;
+}
+
+const pcm_backend alsa_backend = {
+    "alsa",
+    alsa_open,
+    alsa_setup,
+    alsa_link,
+    alsa_unlink,
+    alsa_drop,
+    alsa_recover,
+    alsa_hw_free,
+    alsa_state,
+    alsa_avail,
+    alsa_avail_update,
+    alsa_readi,
+    alsa_writei,
+    alsa_mmap_writei,
+    alsa_readn,
+    alsa_writen,
+    alsa_mmap_writen,
+    alsa_mmap_begin,
+    alsa_mmap_commit,
+    alsa_poll_descriptors_count,
+    alsa_poll_descriptors,
+    alsa_poll_descriptors_revents,
+    alsa_status,
+    alsa_card,
+    alsa_native_formats,
+};
+
+// defined in sim.cc
+extern const pcm_backend sim_backend;
+
+const pcm_backend *all_pcm_backends[] = { &alsa_backend, &sim_backend };
+const int num_pcm_backends = sizeof(all_pcm_backends) / sizeof(all_pcm_backends[0]);
+
+const pcm_backend *backend = &alsa_backend;
+
+// Returns nullptr for unknown names.
+const pcm_backend *find_pcm_backend(const std::string &name) {
+    for (int index = 0; index < num_pcm_backends; ++index) {
+        if (name == all_pcm_backends[index]->name) { return all_pcm_backends[index]; }
+    }
+    return nullptr;
+}
+
+// Stops the linked devices and frees their hardware setup, so they can be
+// set up again for the next measurement.
+void release_pcm_devices(pcm_handle *playback_pcm, pcm_handle *capture_pcm) {
+    int ret = backend->drop(playback_pcm);
+    if (ret < 0) {
+        fprintf(stderr, "Error: snd_pcm_drop: %s\n", snd_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    ret = backend->unlink(capture_pcm);
+    if (ret < 0) {
+        fprintf(stderr, "Error: snd_pcm_unlink: %s\n", snd_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    pcm_handle *pcms[] = { playback_pcm, capture_pcm };
+    for (pcm_handle *pcm : pcms) {
+        ret = backend->hw_free(pcm);
+        if (ret < 0) {
+            fprintf(stderr, "Error: snd_pcm_hw_free: %s\n", snd_strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
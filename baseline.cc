@@ -0,0 +1,123 @@
+// #################### scheduling latency baseline
+//
+// A cyclictest-style thread that sleeps with clock_nanosleep until the
+// next period boundary and records how late it woke up, at the SCHED_FIFO
+// priority of the sampling threads and with their period. Its wakeup error
+// is what the kernel and the scheduler alone cost. Whatever the wakeup
+// jitter of the sampling threads has on top of it comes from the driver
+// and the device. With --baseline parallel it runs during the measurement,
+// best on a sibling core given with --baseline-cpu, with --baseline before
+// alone for as long as the measurement before it, without the co-runners.
+
+enum {
+    baseline_off,
+    baseline_parallel,
+    baseline_before,
+};
+
+int baseline_mode = baseline_off;
+int baseline_cpu;
+
+// The periods of a --baseline before pass without a --sample-size.
+const int baseline_default_periods = 2000;
+
+hdr_histogram baseline_wakeup_error;
+std::atomic<bool> baseline_stop(false);
+pthread_t baseline_thread;
+int64_t baseline_period_ns;
+int baseline_periods;
+
+void setup_baseline(const std::string &mode) {
+    if (mode == "off") { baseline_mode = baseline_off; }
+    else if (mode == "parallel") { baseline_mode = baseline_parallel; }
+    else if (mode == "before") { baseline_mode = baseline_before; }
+    else {
+        fprintf(stderr, "Error: unsupported baseline mode: %s\n", mode.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    const long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (baseline_cpu < -1 || baseline_cpu >= std::min(num_cpus, (long)CPU_SETSIZE)) {
+        fprintf(stderr, "Error: invalid --baseline-cpu %d\n", baseline_cpu);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void *baseline_main(void *) {
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (int period = 0; baseline_periods == 0 || period < baseline_periods; ++period) {
+        if (baseline_stop.load(std::memory_order_relaxed) || stop_requested) { break; }
+
+        next.tv_nsec += baseline_period_ns;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            ++next.tv_sec;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {}
+
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const int64_t error_ns = (now.tv_sec - next.tv_sec) * 1000000000LL + (now.tv_nsec - next.tv_nsec);
+        baseline_wakeup_error.record(std::max(error_ns, (int64_t)0));
+    }
+    return NULL;
+}
+
+// Starts the baseline thread with the policy and priority of the calling
+// thread, on --baseline-cpu if given. periods 0: until stop_baseline.
+static void start_baseline_thread(int periods) {
+    baseline_period_ns = (int64_t)period_size_frames * 1000000000LL / sampling_rate_hz;
+    baseline_periods = periods;
+    baseline_stop.store(false);
+    baseline_wakeup_error.reset();
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (baseline_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(baseline_cpu, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+
+    int ret = pthread_create(&baseline_thread, &attr, baseline_main, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Error: pthread_create baseline: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+// With --baseline before: runs the baseline alone for the periods of the
+// measurement.
+void run_baseline_pass() {
+    if (baseline_mode != baseline_before) { return; }
+    if (verbose) { fprintf(stderr, "Running the scheduling latency baseline...\n"); }
+    start_baseline_thread(sample_size ? sample_size : baseline_default_periods);
+    pthread_join(baseline_thread, NULL);
+}
+
+// With --baseline parallel: starts the baseline next to the measurement.
+void start_baseline() {
+    if (baseline_mode != baseline_parallel) { return; }
+    start_baseline_thread(0);
+}
+
+void stop_baseline() {
+    if (baseline_mode != baseline_parallel) { return; }
+    baseline_stop.store(true);
+    pthread_join(baseline_thread, NULL);
+}
+
+void print_baseline_summary(FILE *file) {
+    if (baseline_mode == baseline_off) { return; }
+    char cpu[16] = "any";
+    if (baseline_cpu >= 0) { snprintf(cpu, sizeof(cpu), "%d", baseline_cpu); }
+    fprintf(file, "baseline (clock_nanosleep every %.1f us, %s, cpu %s)\n", baseline_period_ns * 1e-3, baseline_mode == baseline_parallel ? "parallel" : "before", cpu);
+    print_histogram_header(file);
+    print_histogram(file, "wakeup-error-ns", baseline_wakeup_error);
+}
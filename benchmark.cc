@@ -0,0 +1,88 @@
+// #################### conversion benchmark
+//
+// Runs the capture and playback conversions of the cycle engine on
+// synthetic data for every supported set of kernels, interleaved and
+// planar, and reports the cost per frame and how the planar layout
+// compares to the interleaved one. Uses period_size_frames and num_periods
+// for the block and ringbuffer sizes, just like a real run. Clobbers the
+// conversion globals, so it is only meant to run instead of a measurement.
+
+static double benchmark_elapsed_ns(const timespec &start, const timespec &end) {
+    return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+// Calls convert repeatedly for at least 20 ms and returns ns per frame.
+template <typename Convert>
+static double benchmark_ns_per_frame(Convert convert) {
+    // warm up caches and branch predictors
+    for (int index = 0; index < 16; ++index) { convert(); }
+
+    timespec start, end;
+    long iterations = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        for (int index = 0; index < 16; ++index) { convert(); }
+        iterations += 16;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    } while (benchmark_elapsed_ns(start, end) < 20e6);
+
+    return benchmark_elapsed_ns(start, end) / ((double)iterations * period_size_frames);
+}
+
+void benchmark_conversion() {
+    const int channel_counts[] = { 1, 2, 8, 16, 32, 64 };
+
+    buffer_size_frames = num_periods * period_size_frames;
+    // sized for the most channels once, reshaped for every run
+    spsc_ringbuffer ring;
+    ring.allocate(buffer_size_frames, *std::max_element(std::begin(channel_counts), std::end(channel_counts)));
+
+    if (show_header) {
+        printf(" kernels  format channels      layout capture-ns/frame playback-ns/frame vs-interleaved\n");
+    }
+
+    for (int kernels_index = 0; kernels_index < num_conversion_kernels; ++kernels_index) {
+        if (!conversion_kernels_supported(all_conversion_kernels[kernels_index])) { continue; }
+        kernels = &all_conversion_kernels[kernels_index];
+
+        for (int format = 0; format < trace_num_sample_formats; ++format) {
+            for (int channels : channel_counts) {
+                sample_format = format;
+                sizeof_sample = sample_format_bytes(format);
+                input_channels = output_channels = min_channels = channels;
+
+                std::vector<uint8_t> device_buffer(period_size_frames * channels * sizeof_sample);
+                for (size_t index = 0; index < device_buffer.size(); ++index) {
+                    device_buffer[index] = (uint8_t)(index * 7919);
+                }
+
+                // the interleaved frames, or a plane per channel
+                std::vector<void*> planes(channels);
+                for (int channel = 0; channel < channels; ++channel) {
+                    planes[channel] = device_buffer.data() + (size_t)channel * period_size_frames * sizeof_sample;
+                }
+
+                double interleaved_ns = 0;
+                for (bool planar : { false, true }) {
+                    planar_access = planar;
+                    ring.reshape(buffer_size_frames, channels, planar);
+
+                    const cycle_engine_functions engine = select_cycle_engine();
+
+                    double capture_ns = benchmark_ns_per_frame([&]() {
+                        engine.to_ringbuffer(ring, planes.data(), period_size_frames);
+                    });
+
+                    double playback_ns = benchmark_ns_per_frame([&]() {
+                        engine.from_ringbuffer(ring, planes.data(), period_size_frames);
+                    });
+
+                    if (!planar) { interleaved_ns = capture_ns + playback_ns; }
+                    printf("%8s %7s %8d %11s %16.3f %17.3f %13.1f%%\n", kernels->name, trace_sample_format_names[format], channels, planar ? "planar" : "interleaved", capture_ns, playback_ns, 100 * (capture_ns + playback_ns) / interleaved_ns);
+                }
+            }
+        }
+    }
+
+    ring.release();
+}
@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+// In trace_sample_format_names order.
+const snd_pcm_format_t alsa_sample_formats[] = { SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_FLOAT_LE };
+
 int setup_pcm_device(snd_pcm_t *pcm, int channels) {
     int ret = 0;
 
@@ -16,23 +19,29 @@ int setup_pcm_device(snd_pcm_t *pcm, int channels) {
         exit(EXIT_FAILURE);
     }
 
-    ret = snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    if (ret < 0) {
-        fprintf(stderr, "Error: snd_pcm_hw_params_set_access: %s\n", snd_strerror(ret));
-        exit(EXIT_FAILURE);
+    if (access_mode == "rw") {
+        ret = snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_RW_INTERLEAVED);
     }
-
-    if (sample_format == "S16LE") {
-        ret = snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S16_LE);
+    else if (access_mode == "mmap") {
+        ret = snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+    }
+    else if (access_mode == "rw-planar") {
+        ret = snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_RW_NONINTERLEAVED);
     }
-    else if (sample_format == "S32LE") {
-        ret = snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S32_LE);
+    else if (access_mode == "mmap-planar") {
+        ret = snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
     }
     else {
-        fprintf(stderr, "Error: unsupported sample format\n");
+        fprintf(stderr, "Error: unsupported access mode\n");
         exit(EXIT_FAILURE);
     }
 
+    if (ret < 0) {
+        fprintf(stderr, "Error: snd_pcm_hw_params_set_access: %s\n", snd_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    ret = snd_pcm_hw_params_set_format(pcm, params, alsa_sample_formats[sample_format]);
     if (ret < 0) {
         fprintf(stderr, "Error: snd_pcm_hw_params_set_format: %s\n", snd_strerror(ret));
         exit(EXIT_FAILURE);
@@ -44,7 +53,7 @@ int setup_pcm_device(snd_pcm_t *pcm, int channels) {
         exit(EXIT_FAILURE);
     }
 
-    ret = snd_pcm_hw_params_set_buffer_size(pcm, params, period_size_frames * num_periods);
+    ret = snd_pcm_hw_params_set_buffer_size(pcm, params, device_buffer_frames);
     if (ret < 0) {
         fprintf(stderr, "Error: snd_pcm_hw_params_set_buffer_size: %s\n", snd_strerror(ret));
         exit(EXIT_FAILURE);
@@ -56,6 +65,15 @@ int setup_pcm_device(snd_pcm_t *pcm, int channels) {
         exit(EXIT_FAILURE);
     }
 
+    if (tsched) {
+        // the tsched wait strategy wakes the thread up itself
+        ret = snd_pcm_hw_params_set_period_wakeup(pcm, params, 0);
+        if (ret < 0) {
+            fprintf(stderr, "Error: snd_pcm_hw_params_set_period_wakeup: %s\n", snd_strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+    }
+
     ret = snd_pcm_hw_params(pcm, params);
     if (ret < 0) {
         fprintf(stderr, "Error: snd_pcm_hw_params: %s\n", snd_strerror(ret));
@@ -79,6 +97,19 @@ int setup_pcm_device(snd_pcm_t *pcm, int channels) {
         exit(EXIT_FAILURE);
     }
 
+    // timestamps for snd_pcm_status, on the clock of the wakeup times
+    ret = snd_pcm_sw_params_set_tstamp_mode(pcm, sw_params, SND_PCM_TSTAMP_ENABLE);
+    if (ret < 0) {
+        fprintf(stderr, "Error: snd_pcm_sw_params_set_tstamp_mode: %s\n", snd_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    ret = snd_pcm_sw_params_set_tstamp_type(pcm, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+    if (ret < 0) {
+        fprintf(stderr, "Error: snd_pcm_sw_params_set_tstamp_type: %s\n", snd_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
     // ret = snd_pcm_sw_params_set_start_threshold(pcm, sw_params, 0);
     ret = snd_pcm_sw_params_set_start_threshold(pcm, sw_params, period_size_frames);
     if (ret < 0) {
@@ -97,3 +128,17 @@ int setup_pcm_device(snd_pcm_t *pcm, int channels) {
     return(EXIT_SUCCESS);
 }
 
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+// SIGINT and SIGTERM end sampling gracefully, so unbounded runs still get
+// their output flushed. No SA_RESTART: a blocking poll should return.
+void install_stop_handler() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
@@ -0,0 +1,461 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONVERT_X86 1
+#endif
+
+// #################### sample formats
+//
+// S24LE holds 24 bits in the low bytes of 32, S24_3LE packs them into 3
+// bytes. FLOATLE samples are copied as they are.
+
+// In trace_sample_format_names order.
+enum {
+    sample_format_s16,
+    sample_format_s24,
+    sample_format_s24_3,
+    sample_format_s32,
+    sample_format_float,
+};
+
+// By the work of their conversion, least first: a copy, a multiply, a
+// widening or narrowing multiply, a shift more, a byte shuffle more.
+const int sample_formats_by_cost[] = { sample_format_float, sample_format_s32, sample_format_s16, sample_format_s24, sample_format_s24_3 };
+
+constexpr int sample_format_bytes(int format) {
+    return format == sample_format_s16 ? 2 : format == sample_format_s24_3 ? 3 : 4;
+}
+
+// Returns -1 for unknown names.
+int find_sample_format(const std::string &name) {
+    for (int format = 0; format < trace_num_sample_formats; ++format) {
+        if (name == trace_sample_format_names[format]) { return format; }
+    }
+    return -1;
+}
+
+// #################### sample conversion kernels
+//
+// Each kernel converts n contiguous samples. Integer to float scales by
+// 1/INT{16,24,32}_MAX and float to integer scales by INT{16,24,32}_MAX,
+// truncates and saturates, i.e. the same numbers the original per-sample
+// loops produced, minus the undefined behaviour on overflow. 24 bit samples
+// are read sign extended from bit 23 and written sign extended.
+
+const float s16_to_float_scale = 1.f / (float)INT16_MAX;
+const float float_to_s16_scale = (float)INT16_MAX;
+const float s24_to_float_scale = 1.f / 8388607.f;
+const float float_to_s24_scale = 8388607.f;
+const float s32_to_float_scale = 1.f / (float)INT32_MAX;
+const float float_to_s32_scale = (float)INT32_MAX;
+// The largest float below 2^31, i.e. the largest float that fits an int32_t.
+const float float_to_s32_max = 2147483520.f;
+
+struct conversion_kernels {
+    const char *name;
+    void (*s16_to_float)(const int16_t *in, float *out, int n);
+    void (*s24_to_float)(const int32_t *in, float *out, int n);
+    void (*s24_3_to_float)(const uint8_t *in, float *out, int n);
+    void (*s32_to_float)(const int32_t *in, float *out, int n);
+    void (*float_to_s16)(const float *in, int16_t *out, int n);
+    void (*float_to_s24)(const float *in, int32_t *out, int n);
+    void (*float_to_s24_3)(const float *in, uint8_t *out, int n);
+    void (*float_to_s32)(const float *in, int32_t *out, int n);
+};
+
+static inline int16_t float_to_s16_sample(float in) {
+    float value = in * float_to_s16_scale;
+    value = std::min(std::max(value, (float)INT16_MIN), (float)INT16_MAX);
+    return (int16_t)value;
+}
+
+static inline int32_t float_to_s24_sample(float in) {
+    float value = in * float_to_s24_scale;
+    value = std::min(std::max(value, -8388608.f), 8388607.f);
+    return (int32_t)value;
+}
+
+static inline int32_t float_to_s32_sample(float in) {
+    float value = in * float_to_s32_scale;
+    value = std::min(std::max(value, (float)INT32_MIN), float_to_s32_max);
+    return (int32_t)value;
+}
+
+void s16_to_float_scalar(const int16_t *in, float *out, int n) {
+    for (int index = 0; index < n; ++index) {
+        out[index] = in[index] * s16_to_float_scale;
+    }
+}
+
+void s24_to_float_scalar(const int32_t *in, float *out, int n) {
+    for (int index = 0; index < n; ++index) {
+        out[index] = ((int32_t)((uint32_t)in[index] << 8) >> 8) * s24_to_float_scale;
+    }
+}
+
+void s24_3_to_float_scalar(const uint8_t *in, float *out, int n) {
+    for (int index = 0; index < n; ++index) {
+        const uint8_t *sample = in + 3 * index;
+        const int32_t value = (int32_t)(((uint32_t)sample[0] << 8) | ((uint32_t)sample[1] << 16) | ((uint32_t)sample[2] << 24)) >> 8;
+        out[index] = value * s24_to_float_scale;
+    }
+}
+
+void s32_to_float_scalar(const int32_t *in, float *out, int n) {
+    for (int index = 0; index < n; ++index) {
+        out[index] = in[index] * s32_to_float_scale;
+    }
+}
+
+void float_to_s16_scalar(const float *in, int16_t *out, int n) {
+    for (int index = 0; index < n; ++index) {
+        out[index] = float_to_s16_sample(in[index]);
+    }
+}
+
+void float_to_s24_scalar(const float *in, int32_t *out, int n) {
+    for (int index = 0; index < n; ++index) {
+        out[index] = float_to_s24_sample(in[index]);
+    }
+}
+
+void float_to_s24_3_scalar(const float *in, uint8_t *out, int n) {
+    for (int index = 0; index < n; ++index) {
+        const int32_t value = float_to_s24_sample(in[index]);
+        uint8_t *sample = out + 3 * index;
+        sample[0] = value;
+        sample[1] = value >> 8;
+        sample[2] = value >> 16;
+    }
+}
+
+void float_to_s32_scalar(const float *in, int32_t *out, int n) {
+    for (int index = 0; index < n; ++index) {
+        out[index] = float_to_s32_sample(in[index]);
+    }
+}
+
+#ifdef CONVERT_X86
+
+// ########## SSE2
+
+__attribute__((target("sse2")))
+void s16_to_float_sse2(const int16_t *in, float *out, int n) {
+    const __m128 scale = _mm_set1_ps(s16_to_float_scale);
+    int index = 0;
+    for (; index + 8 <= n; index += 8) {
+        __m128i samples = _mm_loadu_si128((const __m128i*)(in + index));
+        __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+        __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+        _mm_storeu_ps(out + index, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+        _mm_storeu_ps(out + index + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+    }
+    s16_to_float_scalar(in + index, out + index, n - index);
+}
+
+__attribute__((target("sse2")))
+void s24_to_float_sse2(const int32_t *in, float *out, int n) {
+    const __m128 scale = _mm_set1_ps(s24_to_float_scale);
+    int index = 0;
+    for (; index + 4 <= n; index += 4) {
+        __m128i samples = _mm_loadu_si128((const __m128i*)(in + index));
+        samples = _mm_srai_epi32(_mm_slli_epi32(samples, 8), 8);
+        _mm_storeu_ps(out + index, _mm_mul_ps(_mm_cvtepi32_ps(samples), scale));
+    }
+    s24_to_float_scalar(in + index, out + index, n - index);
+}
+
+__attribute__((target("sse2")))
+void s32_to_float_sse2(const int32_t *in, float *out, int n) {
+    const __m128 scale = _mm_set1_ps(s32_to_float_scale);
+    int index = 0;
+    for (; index + 4 <= n; index += 4) {
+        __m128i samples = _mm_loadu_si128((const __m128i*)(in + index));
+        _mm_storeu_ps(out + index, _mm_mul_ps(_mm_cvtepi32_ps(samples), scale));
+    }
+    s32_to_float_scalar(in + index, out + index, n - index);
+}
+
+__attribute__((target("sse2")))
+void float_to_s16_sse2(const float *in, int16_t *out, int n) {
+    const __m128 scale = _mm_set1_ps(float_to_s16_scale);
+    const __m128 min = _mm_set1_ps((float)INT16_MIN);
+    const __m128 max = _mm_set1_ps((float)INT16_MAX);
+    int index = 0;
+    for (; index + 8 <= n; index += 8) {
+        // clamp first, cvttps turns overflow into INT32_MIN and packs into -32768
+        __m128i low = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + index), scale), min), max));
+        __m128i high = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + index + 4), scale), min), max));
+        _mm_storeu_si128((__m128i*)(out + index), _mm_packs_epi32(low, high));
+    }
+    float_to_s16_scalar(in + index, out + index, n - index);
+}
+
+__attribute__((target("sse2")))
+void float_to_s24_sse2(const float *in, int32_t *out, int n) {
+    const __m128 scale = _mm_set1_ps(float_to_s24_scale);
+    const __m128 min = _mm_set1_ps(-8388608.f);
+    const __m128 max = _mm_set1_ps(8388607.f);
+    int index = 0;
+    for (; index + 4 <= n; index += 4) {
+        __m128 value = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + index), scale), min), max);
+        _mm_storeu_si128((__m128i*)(out + index), _mm_cvttps_epi32(value));
+    }
+    float_to_s24_scalar(in + index, out + index, n - index);
+}
+
+__attribute__((target("sse2")))
+void float_to_s32_sse2(const float *in, int32_t *out, int n) {
+    const __m128 scale = _mm_set1_ps(float_to_s32_scale);
+    const __m128 max = _mm_set1_ps(float_to_s32_max);
+    int index = 0;
+    for (; index + 4 <= n; index += 4) {
+        // cvttps already saturates negative overflow to INT32_MIN
+        __m128 value = _mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + index), scale), max);
+        _mm_storeu_si128((__m128i*)(out + index), _mm_cvttps_epi32(value));
+    }
+    float_to_s32_scalar(in + index, out + index, n - index);
+}
+
+// ########## AVX2
+
+__attribute__((target("avx2")))
+void s16_to_float_avx2(const int16_t *in, float *out, int n) {
+    const __m256 scale = _mm256_set1_ps(s16_to_float_scale);
+    int index = 0;
+    for (; index + 16 <= n; index += 16) {
+        __m256i low = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + index)));
+        __m256i high = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + index + 8)));
+        _mm256_storeu_ps(out + index, _mm256_mul_ps(_mm256_cvtepi32_ps(low), scale));
+        _mm256_storeu_ps(out + index + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(high), scale));
+    }
+    s16_to_float_sse2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx2")))
+void s24_to_float_avx2(const int32_t *in, float *out, int n) {
+    const __m256 scale = _mm256_set1_ps(s24_to_float_scale);
+    int index = 0;
+    for (; index + 8 <= n; index += 8) {
+        __m256i samples = _mm256_loadu_si256((const __m256i*)(in + index));
+        samples = _mm256_srai_epi32(_mm256_slli_epi32(samples, 8), 8);
+        _mm256_storeu_ps(out + index, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scale));
+    }
+    s24_to_float_sse2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx2")))
+void s24_3_to_float_avx2(const uint8_t *in, float *out, int n) {
+    const __m256 scale = _mm256_set1_ps(s24_to_float_scale);
+    // 4 packed samples per 128 bit lane into the top 3 bytes of 32 bits
+    const __m256i spread = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    int index = 0;
+    // the lane loads read 4 bytes past the 8 samples
+    for (; index + 10 <= n; index += 8) {
+        const uint8_t *samples = in + 3 * index;
+        __m256i packed = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)samples)), _mm_loadu_si128((const __m128i*)(samples + 12)), 1);
+        __m256i values = _mm256_srai_epi32(_mm256_shuffle_epi8(packed, spread), 8);
+        _mm256_storeu_ps(out + index, _mm256_mul_ps(_mm256_cvtepi32_ps(values), scale));
+    }
+    s24_3_to_float_scalar(in + 3 * index, out + index, n - index);
+}
+
+__attribute__((target("avx2")))
+void s32_to_float_avx2(const int32_t *in, float *out, int n) {
+    const __m256 scale = _mm256_set1_ps(s32_to_float_scale);
+    int index = 0;
+    for (; index + 8 <= n; index += 8) {
+        __m256i samples = _mm256_loadu_si256((const __m256i*)(in + index));
+        _mm256_storeu_ps(out + index, _mm256_mul_ps(_mm256_cvtepi32_ps(samples), scale));
+    }
+    s32_to_float_sse2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx2")))
+void float_to_s16_avx2(const float *in, int16_t *out, int n) {
+    const __m256 scale = _mm256_set1_ps(float_to_s16_scale);
+    const __m256 min = _mm256_set1_ps((float)INT16_MIN);
+    const __m256 max = _mm256_set1_ps((float)INT16_MAX);
+    int index = 0;
+    for (; index + 16 <= n; index += 16) {
+        __m256i low = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + index), scale), min), max));
+        __m256i high = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + index + 8), scale), min), max));
+        // packs works per 128 bit lane, so put the 64 bit quarters back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+        _mm256_storeu_si256((__m256i*)(out + index), packed);
+    }
+    float_to_s16_sse2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx2")))
+void float_to_s24_avx2(const float *in, int32_t *out, int n) {
+    const __m256 scale = _mm256_set1_ps(float_to_s24_scale);
+    const __m256 min = _mm256_set1_ps(-8388608.f);
+    const __m256 max = _mm256_set1_ps(8388607.f);
+    int index = 0;
+    for (; index + 8 <= n; index += 8) {
+        __m256 value = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + index), scale), min), max);
+        _mm256_storeu_si256((__m256i*)(out + index), _mm256_cvttps_epi32(value));
+    }
+    float_to_s24_sse2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx2")))
+void float_to_s24_3_avx2(const float *in, uint8_t *out, int n) {
+    const __m256 scale = _mm256_set1_ps(float_to_s24_scale);
+    const __m256 min = _mm256_set1_ps(-8388608.f);
+    const __m256 max = _mm256_set1_ps(8388607.f);
+    // the low 3 bytes of 4 samples per 128 bit lane to the front of it
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int index = 0;
+    // the lane stores write 4 bytes past the 8 samples, the first one's
+    // are overwritten by the second
+    for (; index + 10 <= n; index += 8) {
+        __m256 value = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + index), scale), min), max);
+        __m256i packed = _mm256_shuffle_epi8(_mm256_cvttps_epi32(value), pack);
+        uint8_t *samples = out + 3 * index;
+        _mm_storeu_si128((__m128i*)samples, _mm256_castsi256_si128(packed));
+        _mm_storeu_si128((__m128i*)(samples + 12), _mm256_extracti128_si256(packed, 1));
+    }
+    float_to_s24_3_scalar(in + index, out + 3 * index, n - index);
+}
+
+__attribute__((target("avx2")))
+void float_to_s32_avx2(const float *in, int32_t *out, int n) {
+    const __m256 scale = _mm256_set1_ps(float_to_s32_scale);
+    const __m256 max = _mm256_set1_ps(float_to_s32_max);
+    int index = 0;
+    for (; index + 8 <= n; index += 8) {
+        __m256 value = _mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in + index), scale), max);
+        _mm256_storeu_si256((__m256i*)(out + index), _mm256_cvttps_epi32(value));
+    }
+    float_to_s32_sse2(in + index, out + index, n - index);
+}
+
+// ########## AVX-512
+
+// gcc 12 warns about the deliberately undefined pass-through operands inside
+// its own avx512 intrinsics at -O3
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+void s16_to_float_avx512(const int16_t *in, float *out, int n) {
+    const __m512 scale = _mm512_set1_ps(s16_to_float_scale);
+    int index = 0;
+    for (; index + 16 <= n; index += 16) {
+        __m512i samples = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(in + index)));
+        _mm512_storeu_ps(out + index, _mm512_mul_ps(_mm512_cvtepi32_ps(samples), scale));
+    }
+    s16_to_float_avx2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx512f")))
+void s24_to_float_avx512(const int32_t *in, float *out, int n) {
+    const __m512 scale = _mm512_set1_ps(s24_to_float_scale);
+    int index = 0;
+    for (; index + 16 <= n; index += 16) {
+        __m512i samples = _mm512_loadu_si512((const void*)(in + index));
+        samples = _mm512_srai_epi32(_mm512_slli_epi32(samples, 8), 8);
+        _mm512_storeu_ps(out + index, _mm512_mul_ps(_mm512_cvtepi32_ps(samples), scale));
+    }
+    s24_to_float_avx2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx512f")))
+void s32_to_float_avx512(const int32_t *in, float *out, int n) {
+    const __m512 scale = _mm512_set1_ps(s32_to_float_scale);
+    int index = 0;
+    for (; index + 16 <= n; index += 16) {
+        __m512i samples = _mm512_loadu_si512((const void*)(in + index));
+        _mm512_storeu_ps(out + index, _mm512_mul_ps(_mm512_cvtepi32_ps(samples), scale));
+    }
+    s32_to_float_avx2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx512f")))
+void float_to_s16_avx512(const float *in, int16_t *out, int n) {
+    const __m512 scale = _mm512_set1_ps(float_to_s16_scale);
+    const __m512 min = _mm512_set1_ps((float)INT16_MIN);
+    const __m512 max = _mm512_set1_ps((float)INT16_MAX);
+    int index = 0;
+    for (; index + 16 <= n; index += 16) {
+        __m512i value = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(in + index), scale), min), max));
+        _mm256_storeu_si256((__m256i*)(out + index), _mm512_cvtsepi32_epi16(value));
+    }
+    float_to_s16_avx2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx512f")))
+void float_to_s24_avx512(const float *in, int32_t *out, int n) {
+    const __m512 scale = _mm512_set1_ps(float_to_s24_scale);
+    const __m512 min = _mm512_set1_ps(-8388608.f);
+    const __m512 max = _mm512_set1_ps(8388607.f);
+    int index = 0;
+    for (; index + 16 <= n; index += 16) {
+        __m512 value = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(in + index), scale), min), max);
+        _mm512_storeu_si512((void*)(out + index), _mm512_cvttps_epi32(value));
+    }
+    float_to_s24_avx2(in + index, out + index, n - index);
+}
+
+__attribute__((target("avx512f")))
+void float_to_s32_avx512(const float *in, int32_t *out, int n) {
+    const __m512 scale = _mm512_set1_ps(float_to_s32_scale);
+    const __m512 max = _mm512_set1_ps(float_to_s32_max);
+    int index = 0;
+    for (; index + 16 <= n; index += 16) {
+        __m512 value = _mm512_min_ps(_mm512_mul_ps(_mm512_loadu_ps(in + index), scale), max);
+        _mm512_storeu_si512((void*)(out + index), _mm512_cvttps_epi32(value));
+    }
+    float_to_s32_avx2(in + index, out + index, n - index);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+// Packed 24 bit samples need a byte shuffle, which sse2 lacks and avx2
+// already does per 128 bit lane, so sse2 and avx512 share the neighbouring
+// kernels for them.
+const conversion_kernels all_conversion_kernels[] = {
+    { "scalar", s16_to_float_scalar, s24_to_float_scalar, s24_3_to_float_scalar, s32_to_float_scalar, float_to_s16_scalar, float_to_s24_scalar, float_to_s24_3_scalar, float_to_s32_scalar },
+#ifdef CONVERT_X86
+    { "sse2", s16_to_float_sse2, s24_to_float_sse2, s24_3_to_float_scalar, s32_to_float_sse2, float_to_s16_sse2, float_to_s24_sse2, float_to_s24_3_scalar, float_to_s32_sse2 },
+    { "avx2", s16_to_float_avx2, s24_to_float_avx2, s24_3_to_float_avx2, s32_to_float_avx2, float_to_s16_avx2, float_to_s24_avx2, float_to_s24_3_avx2, float_to_s32_avx2 },
+    { "avx512", s16_to_float_avx512, s24_to_float_avx512, s24_3_to_float_avx2, s32_to_float_avx512, float_to_s16_avx512, float_to_s24_avx512, float_to_s24_3_avx2, float_to_s32_avx512 },
+#endif
+};
+
+const int num_conversion_kernels = sizeof(all_conversion_kernels) / sizeof(all_conversion_kernels[0]);
+
+// Whether the cpu we are running on can execute the given kernels.
+bool conversion_kernels_supported(const conversion_kernels &candidate) {
+#ifdef CONVERT_X86
+    __builtin_cpu_init();
+    if (strcmp(candidate.name, "sse2") == 0) { return __builtin_cpu_supports("sse2"); }
+    if (strcmp(candidate.name, "avx2") == 0) { return __builtin_cpu_supports("avx2"); }
+    if (strcmp(candidate.name, "avx512") == 0) { return __builtin_cpu_supports("avx512f"); }
+#endif
+    return strcmp(candidate.name, "scalar") == 0;
+}
+
+// Returns the kernels with the given name, or the widest supported ones for
+// "auto". Returns nullptr if the name is unknown or the cpu lacks support.
+const conversion_kernels *find_conversion_kernels(const std::string &name) {
+    const conversion_kernels *found = nullptr;
+    for (int index = 0; index < num_conversion_kernels; ++index) {
+        const conversion_kernels &candidate = all_conversion_kernels[index];
+        if (!conversion_kernels_supported(candidate)) { continue; }
+        if (name == "auto" || name == candidate.name) { found = &candidate; }
+    }
+    return found;
+}
+
+// The kernels used by the measurement loops. Chosen once at startup.
+const conversion_kernels *kernels = &all_conversion_kernels[0];
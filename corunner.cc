@@ -0,0 +1,465 @@
+// #################### co-runners
+//
+// Every --corunner starts a thread that interferes with the sampling
+// threads in one way for the whole measurement:
+//
+// membw      copies between the halves of its working set, saturating the
+//            memory bandwidth
+// cache      walks the cache lines of its working set in a random cycle,
+//            evicting everything else from the last level cache
+// syscall    calls getppid in a loop
+// pagefault  touches every page of its working set and drops the pages
+//            again, so every touch is a minor fault
+//
+// A co-runner alternates between on and off phases of the given lengths,
+// or stays on with off=0. The start of every phase is recorded and written
+// into the sample output at its place in the timeline, so every stretch
+// of samples can be related to the interference it ran under. Each
+// co-runner has its own scheduling policy, priority and cpu, and its
+// working set is allocated, locked and prefaulted before measuring.
+
+// In the order of trace_corunner_kind_names.
+enum corunner_kind {
+    corunner_membw,
+    corunner_cache,
+    corunner_syscall,
+    corunner_pagefault,
+    num_corunner_kinds
+};
+
+struct corunner_phase {
+    timespec time;
+    int corunner;
+    int on;
+    // the operations of the co-runner so far
+    uint64_t operations;
+};
+
+struct corunner;
+
+struct corunner_functions {
+    const char *name;
+    // the operations a rate is reported in, and their scale
+    const char *unit;
+    double unit_scale;
+    size_t default_size;
+    // allocates the working set, before measuring
+    void (*allocate)(corunner &self);
+    // interferes for a moment, returns the number of operations done
+    uint64_t (*work)(corunner &self);
+};
+
+struct corunner {
+    int index;
+    int kind;
+    // -1: not pinned
+    int cpu;
+    int policy;
+    int priority;
+    size_t size;
+    int on_ms;
+    int off_ms;
+
+    uint8_t *memory;
+    // the next cache line of the walk, or the next page to touch
+    size_t position;
+
+    pthread_t thread;
+    spsc_queue<corunner_phase> phases;
+    std::atomic<uint64_t> dropped_phases;
+
+    // written by the co-runner thread, read after joining it
+    uint64_t operations;
+    uint64_t on_operations;
+    int64_t on_ns;
+    int num_on_phases;
+};
+
+const int max_corunners = 16;
+const int corunner_phase_queue_size = 16384;
+
+corunner corunners[max_corunners];
+int num_corunners = 0;
+std::atomic<bool> corunners_stop(false);
+
+// ########## membw
+
+static void corunner_membw_allocate(corunner &self) {
+    self.memory = (uint8_t*)aligned_alloc(cache_line_bytes, self.size);
+    if (!self.memory) {
+        fprintf(stderr, "Error: failed to allocate %zu bytes for corunner %d\n", self.size, self.index);
+        exit(EXIT_FAILURE);
+    }
+    memset(self.memory, 1, self.size);
+    self.position = 0;
+}
+
+// Copies a megabyte from the first half of the working set to the second.
+static uint64_t corunner_membw_work(corunner &self) {
+    const size_t half = self.size / 2;
+    const size_t bytes = std::min((size_t)1024 * 1024, half - self.position);
+    memcpy(self.memory + half + self.position, self.memory + self.position, bytes);
+    self.position = (self.position + bytes) % half;
+    // read and written
+    return 2 * bytes;
+}
+
+// ########## cache
+
+// Links all cache lines into one random cycle (Sattolo's algorithm), every
+// line holding the index of the next.
+static void corunner_cache_allocate(corunner &self) {
+    corunner_membw_allocate(self);
+
+    const uint32_t lines = self.size / cache_line_bytes;
+    std::vector<uint32_t> order(lines);
+    for (uint32_t line = 0; line < lines; ++line) { order[line] = line; }
+    uint64_t random = 0x9e3779b97f4a7c15ULL;
+    for (uint32_t line = lines - 1; line > 0; --line) {
+        random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+        std::swap(order[line], order[(random >> 33) % line]);
+    }
+    for (uint32_t line = 0; line < lines; ++line) {
+        *(uint32_t*)(self.memory + (size_t)order[line] * cache_line_bytes) = order[(line + 1) % lines];
+    }
+}
+
+// Follows the cycle for 16384 lines, dirtying each so it has to be written
+// back when evicted.
+static uint64_t corunner_cache_work(corunner &self) {
+    size_t line = self.position;
+    for (int step = 0; step < 16384; ++step) {
+        uint8_t *bytes = self.memory + line * cache_line_bytes;
+        ++bytes[cache_line_bytes - 1];
+        line = *(uint32_t*)bytes;
+    }
+    self.position = line;
+    return 16384;
+}
+
+// ########## syscall
+
+static void corunner_syscall_allocate(corunner &self) {
+    self.memory = nullptr;
+}
+
+static uint64_t corunner_syscall_work(corunner &) {
+    for (int call = 0; call < 1000; ++call) {
+        syscall(SYS_getppid);
+    }
+    return 1000;
+}
+
+// ########## pagefault
+
+// The mapping is populated and locked by MCL_FUTURE, so it's unlocked
+// again to be able to drop its pages.
+static void corunner_pagefault_allocate(corunner &self) {
+    void *mapped = mmap(NULL, self.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap %zu bytes for corunner %d: %s\n", self.size, self.index, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    munlock(mapped, self.size);
+    madvise(mapped, self.size, MADV_DONTNEED);
+    self.memory = (uint8_t*)mapped;
+    self.position = 0;
+}
+
+// Touches 256 pages, and drops all pages after touching the last.
+static uint64_t corunner_pagefault_work(corunner &self) {
+    const size_t pages = self.size / page_bytes;
+    const size_t end = std::min(pages, self.position + 256);
+    for (size_t page = self.position; page < end; ++page) {
+        self.memory[page * page_bytes] = 1;
+    }
+    const uint64_t touched = end - self.position;
+
+    self.position = end;
+    if (self.position == pages) {
+        madvise(self.memory, self.size, MADV_DONTNEED);
+        self.position = 0;
+    }
+    return touched;
+}
+
+const corunner_functions corunner_kinds[num_corunner_kinds] = {
+    { trace_corunner_kind_names[corunner_membw], "MB", 1e-6, 64 * 1024 * 1024, corunner_membw_allocate, corunner_membw_work },
+    { trace_corunner_kind_names[corunner_cache], "M lines", 1e-6, 0, corunner_cache_allocate, corunner_cache_work },
+    { trace_corunner_kind_names[corunner_syscall], "k syscalls", 1e-3, 0, corunner_syscall_allocate, corunner_syscall_work },
+    { trace_corunner_kind_names[corunner_pagefault], "k faults", 1e-3, 16 * 1024 * 1024, corunner_pagefault_allocate, corunner_pagefault_work },
+};
+
+// ########## setup
+
+static const char *const corunner_policy_names[] = { "other", "batch", "idle", "fifo", "rr" };
+static const int corunner_policies[] = { SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO, SCHED_RR };
+
+static const char *corunner_policy_name(int policy) {
+    for (size_t index = 0; index < sizeof(corunner_policies) / sizeof(corunner_policies[0]); ++index) {
+        if (corunner_policies[index] == policy) { return corunner_policy_names[index]; }
+    }
+    return "?";
+}
+
+// Parses sizes like 4096, 512K, 64M or 1G.
+static bool parse_corunner_size(const char *text, size_t &size) {
+    char *end;
+    const unsigned long long value = strtoull(text, &end, 10);
+    size_t scale = 1;
+    if (*end == 'K' || *end == 'k') { scale = 1024; ++end; }
+    else if (*end == 'M' || *end == 'm') { scale = 1024 * 1024; ++end; }
+    else if (*end == 'G' || *end == 'g') { scale = 1024 * 1024 * 1024; ++end; }
+    size = value * scale;
+    return end != text && *end == 0;
+}
+
+// Twice the last level cache, so the walk misses it every time.
+static size_t default_cache_corunner_size() {
+    const long l3_bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    const long l2_bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    const long cache_bytes = (l3_bytes > 0) ? l3_bytes : l2_bytes;
+    return (cache_bytes > 0) ? 2 * cache_bytes : 32 * 1024 * 1024;
+}
+
+// Parses every --corunner, kind[:key=value,...] with the keys cpu,
+// policy, priority, size, on and off (milliseconds).
+void setup_corunners(const std::vector<std::string> &specs) {
+    if ((int)specs.size() > max_corunners) {
+        fprintf(stderr, "Error: at most %d co-runners are supported.\n", max_corunners);
+        exit(EXIT_FAILURE);
+    }
+
+    const long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    num_corunners = specs.size();
+    for (int index = 0; index < num_corunners; ++index) {
+        corunner &self = corunners[index];
+        const std::string &spec = specs[index];
+        const size_t colon = spec.find(':');
+        const std::string kind_name = spec.substr(0, colon);
+
+        self.index = index;
+        self.kind = -1;
+        for (int kind = 0; kind < num_corunner_kinds; ++kind) {
+            if (kind_name == corunner_kinds[kind].name) { self.kind = kind; }
+        }
+        if (self.kind < 0) {
+            fprintf(stderr, "Error: unsupported corunner: %s\n", kind_name.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        self.cpu = -1;
+        self.policy = SCHED_OTHER;
+        self.priority = 0;
+        self.size = (self.kind == corunner_cache) ? default_cache_corunner_size() : corunner_kinds[self.kind].default_size;
+        self.on_ms = 1000;
+        self.off_ms = 1000;
+
+        size_t start = (colon == std::string::npos) ? spec.size() + 1 : colon + 1;
+        while (start <= spec.size()) {
+            size_t end = spec.find(',', start);
+            if (end == std::string::npos) { end = spec.size(); }
+            const std::string item = spec.substr(start, end - start);
+            start = end + 1;
+
+            const size_t equals = item.find('=');
+            const std::string key = item.substr(0, equals);
+            const std::string value = (equals == std::string::npos) ? "" : item.substr(equals + 1);
+            char *value_end = nullptr;
+            bool valid = !value.empty();
+            if (key == "cpu") {
+                self.cpu = strtol(value.c_str(), &value_end, 10);
+                valid = valid && !*value_end && self.cpu >= 0 && self.cpu < std::min(num_cpus, (long)CPU_SETSIZE);
+            }
+            else if (key == "priority") {
+                self.priority = strtol(value.c_str(), &value_end, 10);
+                valid = valid && !*value_end;
+            }
+            else if (key == "on" || key == "off") {
+                int &ms = (key == "on") ? self.on_ms : self.off_ms;
+                ms = strtol(value.c_str(), &value_end, 10);
+                valid = valid && !*value_end && ms >= (key == "on" ? 1 : 0);
+            }
+            else if (key == "size") {
+                valid = valid && parse_corunner_size(value.c_str(), self.size);
+            }
+            else if (key == "policy") {
+                valid = false;
+                for (size_t policy = 0; policy < sizeof(corunner_policies) / sizeof(corunner_policies[0]); ++policy) {
+                    if (value == corunner_policy_names[policy]) {
+                        self.policy = corunner_policies[policy];
+                        valid = true;
+                    }
+                }
+            }
+            else {
+                valid = false;
+            }
+
+            if (!valid) {
+                fprintf(stderr, "Error: invalid --corunner option: '%s' in '%s'\n", item.c_str(), spec.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        const bool realtime = (self.policy == SCHED_FIFO || self.policy == SCHED_RR);
+        if (realtime ? (self.priority < sched_get_priority_min(self.policy) || self.priority > sched_get_priority_max(self.policy)) : self.priority != 0) {
+            fprintf(stderr, "Error: invalid priority %d for the %s policy of corunner %d\n", self.priority, corunner_policy_name(self.policy), index);
+            exit(EXIT_FAILURE);
+        }
+
+        // the cache walk needs two lines to form a cycle, the others two pages
+        if (self.kind == corunner_cache && self.size < 2 * cache_line_bytes) {
+            fprintf(stderr, "Error: the size of corunner %d must be at least two cache lines.\n", index);
+            exit(EXIT_FAILURE);
+        }
+        if (self.kind != corunner_cache && self.kind != corunner_syscall && self.size < 2 * page_bytes) {
+            fprintf(stderr, "Error: the size of corunner %d must be at least two pages.\n", index);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Allocates the working sets and phase queues. After mlockall, so the
+// working sets are locked and prefaulted like everything else.
+void allocate_corunners() {
+    for (int index = 0; index < num_corunners; ++index) {
+        corunner &self = corunners[index];
+        if (verbose) { fprintf(stderr, "Allocating %zu bytes for corunner %d %s...\n", self.size, index, corunner_kinds[self.kind].name); }
+        corunner_kinds[self.kind].allocate(self);
+        self.phases.allocate(corunner_phase_queue_size);
+    }
+}
+
+// ########## threads
+
+static void corunner_record_phase(corunner &self, bool on) {
+    corunner_phase phase;
+    clock_gettime(CLOCK_MONOTONIC, &phase.time);
+    phase.corunner = self.index;
+    phase.on = on;
+    phase.operations = self.operations;
+    if (!self.phases.push(phase)) {
+        self.dropped_phases.store(self.dropped_phases.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+static void *corunner_main(void *arg) {
+    corunner &self = *(corunner*)arg;
+    const corunner_functions &functions = corunner_kinds[self.kind];
+
+    sched_param param;
+    param.sched_priority = self.priority;
+    if (sched_setscheduler(0, self.policy, &param) != 0) {
+        fprintf(stderr, "Error: sched_setscheduler corunner %d: %s\n", self.index, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    while (!corunners_stop.load(std::memory_order_relaxed)) {
+        corunner_record_phase(self, true);
+        ++self.num_on_phases;
+
+        const int64_t on_start_ns = wait_now_ns();
+        const int64_t on_end_ns = on_start_ns + self.on_ms * 1000000LL;
+        const uint64_t start_operations = self.operations;
+        int64_t now_ns = on_start_ns;
+        while (!corunners_stop.load(std::memory_order_relaxed) && (self.off_ms == 0 || now_ns < on_end_ns)) {
+            self.operations += functions.work(self);
+            now_ns = wait_now_ns();
+        }
+        self.on_ns += now_ns - on_start_ns;
+        self.on_operations += self.operations - start_operations;
+
+        corunner_record_phase(self, false);
+
+        // in slices, to notice the stop in time
+        const int64_t off_end_ns = on_end_ns + self.off_ms * 1000000LL;
+        while (!corunners_stop.load(std::memory_order_relaxed) && (now_ns = wait_now_ns()) < off_end_ns) {
+            timespec ts;
+            ts.tv_sec = 0;
+            ts.tv_nsec = std::min(off_end_ns - now_ns, (int64_t)10000000);
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+// Starts all co-runners with their own policy, priority and cpu, with
+// empty phase queues and stats.
+void start_corunners() {
+    corunners_stop.store(false);
+
+    for (int index = 0; index < num_corunners; ++index) {
+        corunner &self = corunners[index];
+        while (self.phases.front()) { self.phases.pop(); }
+        self.dropped_phases.store(0);
+        self.operations = 0;
+        self.on_operations = 0;
+        self.on_ns = 0;
+        self.num_on_phases = 0;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        // pthread attributes only take SCHED_OTHER, SCHED_FIFO and
+        // SCHED_RR, so the thread sets its policy itself
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+        sched_param param;
+        param.sched_priority = 0;
+        pthread_attr_setschedparam(&attr, &param);
+        pthread_attr_setstacksize(&attr, 256 * 1024);
+        if (self.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(self.cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+
+        int ret = pthread_create(&self.thread, &attr, corunner_main, &self);
+        if (ret != 0) {
+            fprintf(stderr, "Error: pthread_create corunner %d: %s\n", index, strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+}
+
+// Stops and joins all co-runners. Their last phase ends now.
+void stop_corunners() {
+    corunners_stop.store(true);
+    for (int index = 0; index < num_corunners; ++index) {
+        pthread_join(corunners[index].thread, NULL);
+    }
+}
+
+// The co-runner with the oldest unwritten phase, or nullptr if none.
+corunner *oldest_corunner_phase() {
+    corunner *oldest = nullptr;
+    for (int index = 0; index < num_corunners; ++index) {
+        const corunner_phase *candidate = corunners[index].phases.front();
+        if (!candidate) { continue; }
+        if (!oldest) { oldest = &corunners[index]; continue; }
+
+        const corunner_phase *current = oldest->phases.front();
+        if (candidate->time.tv_sec < current->time.tv_sec || (candidate->time.tv_sec == current->time.tv_sec && candidate->time.tv_nsec < current->time.tv_nsec)) {
+            oldest = &corunners[index];
+        }
+    }
+    return oldest;
+}
+
+void print_corunner_summary(FILE *file) {
+    for (int index = 0; index < num_corunners; ++index) {
+        const corunner &self = corunners[index];
+        const corunner_functions &functions = corunner_kinds[self.kind];
+        char cpu[16] = "any";
+        if (self.cpu >= 0) { snprintf(cpu, sizeof(cpu), "%d", self.cpu); }
+        fprintf(file, "corunner %d %s (cpu %s, %s %d): %d on phases, %.3f s on, %.1f %s/s while on\n", index, functions.name, cpu, corunner_policy_name(self.policy), self.priority, self.num_on_phases, self.on_ns * 1e-9, self.on_ns > 0 ? self.on_operations * functions.unit_scale / (self.on_ns * 1e-9) : 0.0, functions.unit);
+
+        const uint64_t dropped = self.dropped_phases.load();
+        if (dropped) {
+            fprintf(file, "Warning: corunner %d dropped %lu phases\n", index, dropped);
+        }
+    }
+}
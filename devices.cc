@@ -0,0 +1,326 @@
+// #################### pcm devices
+//
+// Every --pcm-device-name is measured at the same time by its own
+// sampling thread, which inherits SCHED_FIFO and the priority of the main
+// thread and is pinned to its --cpu if given. With --irq-affinity the
+// interrupt of the card of a pinned device and its irq thread move to the
+// same cpu, so the whole path from the interrupt to the wakeup stays on
+// one core. All threads stamp their samples with CLOCK_MONOTONIC, so the
+// samples of all devices merge into one timeline on output.
+
+struct pcm_device {
+    int index;
+    std::string name;
+    std::string capture_name;
+    // -1: not pinned
+    int cpu;
+    pcm_handle *playback;
+    pcm_handle *capture;
+    // the frames of the rw access, interleaved, or with planar access
+    // buffer_frames samples of every channel after each other
+    uint8_t *input_buffer;
+    uint8_t *output_buffer;
+    int buffer_frames;
+    // the buffer of every channel for the next transfer, filled by the
+    // capture and the playback side of the cycle engine
+    std::vector<void*> capture_transfer;
+    std::vector<void*> playback_transfer;
+    // between the capture and the playback of this device
+    spsc_ringbuffer ring;
+    pthread_t thread;
+};
+
+pcm_device pcm_devices[max_pcm_devices];
+int num_pcm_devices = 0;
+
+// The names of all devices for the trace header.
+std::string pcm_device_names_joined() {
+    std::string names;
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        if (index) { names += " "; }
+        names += pcm_devices[index].name;
+    }
+    return names;
+}
+
+// Fills pcm_devices from the options. Capture devices and cpus are
+// matched to the devices by position, a single capture device name only
+// fits a single device.
+void setup_pcm_devices(const std::vector<std::string> &names, const std::vector<std::string> &capture_names, const std::vector<int> &cpus) {
+    if (names.empty() || (int)names.size() > max_pcm_devices) {
+        fprintf(stderr, "Error: between 1 and %d pcm devices are supported.\n", max_pcm_devices);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!capture_names.empty() && capture_names.size() != names.size()) {
+        fprintf(stderr, "Error: --capture-pcm-device-name must be given once for every --pcm-device-name.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!cpus.empty() && cpus.size() != names.size()) {
+        fprintf(stderr, "Error: --cpu must be given once for every --pcm-device-name.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    num_pcm_devices = names.size();
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        pcm_device &device = pcm_devices[index];
+        device.index = index;
+        device.name = names[index];
+        device.capture_name = capture_names.empty() ? names[index] : capture_names[index];
+        device.cpu = cpus.empty() ? -1 : cpus[index];
+        device.playback = nullptr;
+        device.capture = nullptr;
+        device.input_buffer = nullptr;
+        device.output_buffer = nullptr;
+        device.buffer_frames = 0;
+
+        if (device.cpu < -1 || device.cpu >= std::min(num_cpus, (long)CPU_SETSIZE)) {
+            fprintf(stderr, "Error: invalid --cpu %d for %s\n", device.cpu, device.name.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// ########## sample format negotiation
+
+static std::string sample_format_list(int formats) {
+    std::string list;
+    for (int format = 0; format < trace_num_sample_formats; ++format) {
+        if (!(formats & (1 << format))) { continue; }
+        if (!list.empty()) { list += " "; }
+        list += trace_sample_format_names[format];
+    }
+    return list.empty() ? "none" : list;
+}
+
+// Sets sample_format and sizeof_sample from the --sample-format name. A
+// format the hardware doesn't support is converted by the plug layer of
+// alsa-lib, unnoticed and on the measured path, so auto picks the one of
+// sample_formats_by_cost that the hardware behind every playback and
+// capture device supports, and an explicit format is checked the same way.
+void setup_sample_format(const std::string &name) {
+    const bool automatic = (name == "auto");
+    sample_format = automatic ? sample_format_s32 : find_sample_format(name);
+    if (sample_format < 0) {
+        fprintf(stderr, "Error: unsupported sample format: %s\n", name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    int native = (1 << trace_num_sample_formats) - 1;
+    bool known = false;
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        const pcm_device &device = pcm_devices[index];
+        const std::pair<const std::string*, snd_pcm_stream_t> ends[] = { { &device.name, SND_PCM_STREAM_PLAYBACK }, { &device.capture_name, SND_PCM_STREAM_CAPTURE } };
+        for (const auto &end : ends) {
+            const int formats = backend->native_formats(end.first->c_str(), end.second);
+            if (formats < 0) {
+                fprintf(stderr, "Warning: can't find the hardware formats of %s: %s\n", end.first->c_str(), snd_strerror(formats));
+                continue;
+            }
+            if (verbose) { fprintf(stderr, "Native formats of %s: %s\n", end.first->c_str(), sample_format_list(formats).c_str()); }
+            if (!automatic && !(formats & (1 << sample_format))) {
+                fprintf(stderr, "Warning: the hardware of %s doesn't support %s, alsa-lib converts on the measured path\n", end.first->c_str(), name.c_str());
+            }
+            native &= formats;
+            known = true;
+        }
+    }
+
+    if (automatic) {
+        const int *cheapest = std::find_if(std::begin(sample_formats_by_cost), std::end(sample_formats_by_cost), [&](int format) { return native & (1 << format); });
+        if (!known) {
+            fprintf(stderr, "Warning: no hardware formats known, using S32LE\n");
+        }
+        else if (cheapest == std::end(sample_formats_by_cost)) {
+            fprintf(stderr, "Warning: the devices share no native format, using S32LE through the plug layer\n");
+        }
+        else {
+            sample_format = *cheapest;
+        }
+        fprintf(stderr, "sample format: %s (auto, native: %s)\n", trace_sample_format_names[sample_format], known ? sample_format_list(native).c_str() : "unknown");
+    }
+
+    sizeof_sample = sample_format_bytes(sample_format);
+}
+
+// What allocate_pcm_device_buffers takes from the run arena.
+size_t pcm_device_buffers_bytes(int frames) {
+    return num_pcm_devices * (arena_round((size_t)frames * sizeof_sample * input_channels) + arena_round((size_t)frames * sizeof_sample * output_channels));
+}
+
+// Allocates zeroed rw buffers of frames frames for every device.
+void allocate_pcm_device_buffers(int frames) {
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        pcm_device &device = pcm_devices[index];
+        device.input_buffer = (uint8_t*)arena_allocate((size_t)frames * sizeof_sample * input_channels);
+        device.output_buffer = (uint8_t*)arena_allocate((size_t)frames * sizeof_sample * output_channels);
+        device.buffer_frames = frames;
+        device.capture_transfer.assign(input_channels, nullptr);
+        device.playback_transfer.assign(output_channels, nullptr);
+    }
+}
+
+void open_pcm_devices() {
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        pcm_device &device = pcm_devices[index];
+
+        if (verbose) { fprintf(stderr, "Opening playback device %s...\n", device.name.c_str()); }
+
+        int ret = backend->open(&device.playback, device.name.c_str(), SND_PCM_STREAM_PLAYBACK);
+        if (ret < 0) {
+            fprintf(stderr, "Error: snd_pcm_open %s: %s\n", device.name.c_str(), snd_strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+
+        if (verbose) { fprintf(stderr, "Opening capture device %s...\n", device.capture_name.c_str()); }
+
+        ret = backend->open(&device.capture, device.capture_name.c_str(), SND_PCM_STREAM_CAPTURE);
+        if (ret < 0) {
+            fprintf(stderr, "Error: snd_pcm_open %s: %s\n", device.capture_name.c_str(), snd_strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// ########## interrupt affinity
+
+// The interrupts of a card. The sound device of a USB card has none of its
+// own, so the parents are searched up to the controller that has some.
+// MSI interrupts are listed in msi_irqs, the irq file then only holds the
+// unused legacy line.
+static std::vector<int> card_irqs(int card) {
+    std::vector<int> irqs;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/class/sound/card%d/device", card);
+    char resolved[PATH_MAX];
+    if (!realpath(path, resolved)) { return irqs; }
+
+    std::string directory = resolved;
+    while (irqs.empty() && directory.size() > strlen("/sys/devices")) {
+        DIR *msi = opendir((directory + "/msi_irqs").c_str());
+        if (msi) {
+            while (dirent *entry = readdir(msi)) {
+                if (entry->d_name[0] >= '0' && entry->d_name[0] <= '9') { irqs.push_back(atoi(entry->d_name)); }
+            }
+            closedir(msi);
+        }
+
+        FILE *file = fopen((directory + "/irq").c_str(), "r");
+        if (irqs.empty() && file) {
+            int irq;
+            if (fscanf(file, "%d", &irq) == 1 && irq > 0) { irqs.push_back(irq); }
+        }
+        if (file) { fclose(file); }
+
+        directory = directory.substr(0, directory.rfind('/'));
+    }
+
+    std::sort(irqs.begin(), irqs.end());
+    return irqs;
+}
+
+// Moves the threads of a threaded interrupt (named irq/<irq>-<name>, with
+// threadirqs or PREEMPT_RT) to cpu. Returns how many there were.
+static int pin_irq_threads(int irq, int cpu) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "irq/%d-", irq);
+
+    DIR *proc = opendir("/proc");
+    if (!proc) { return 0; }
+
+    int pinned = 0;
+    while (dirent *entry = readdir(proc)) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') { continue; }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        FILE *file = fopen(path, "r");
+        if (!file) { continue; }
+        char comm[64] = { 0 };
+        const bool read = fgets(comm, sizeof(comm), file) != NULL;
+        fclose(file);
+        if (!read || strncmp(comm, prefix, strlen(prefix)) != 0) { continue; }
+        comm[strcspn(comm, "\n")] = 0;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(atoi(entry->d_name), sizeof(set), &set) != 0) {
+            fprintf(stderr, "Error: sched_setaffinity %s: %s\n", comm, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (verbose) { fprintf(stderr, "Pinned %s to cpu %d\n", comm, cpu); }
+        ++pinned;
+    }
+
+    closedir(proc);
+    return pinned;
+}
+
+// Pins the interrupts of the card of every pinned device, and their
+// threads, to the cpu of the device. Needs root.
+void pin_pcm_device_irqs() {
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        const pcm_device &device = pcm_devices[index];
+        if (device.cpu < 0) { continue; }
+
+        const int card = backend->card(device.playback);
+        if (card < 0) {
+            fprintf(stderr, "Warning: %s has no sound card, not moving its interrupt\n", device.name.c_str());
+            continue;
+        }
+
+        const std::vector<int> irqs = card_irqs(card);
+        if (irqs.empty()) {
+            fprintf(stderr, "Warning: no interrupt found for card %d of %s\n", card, device.name.c_str());
+            continue;
+        }
+
+        for (int irq : irqs) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+            FILE *file = fopen(path, "w");
+            if (!file || fprintf(file, "%d\n", device.cpu) < 0 || fclose(file) != 0) {
+                fprintf(stderr, "Error: writing %s: %s\n", path, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            const int threads = pin_irq_threads(irq, device.cpu);
+            fprintf(stderr, "%s: card %d irq %d%s pinned to cpu %d\n", device.name.c_str(), card, irq, threads ? " and its thread" : "", device.cpu);
+        }
+    }
+}
+
+// ########## sampling threads
+
+// Starts fn(device) for every device on its own thread, pinned to the cpu
+// of the device, and waits for all of them.
+void run_pcm_device_threads(void *(*fn)(void *)) {
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        pcm_device &device = pcm_devices[index];
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (device.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(device.cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+
+        int ret = pthread_create(&device.thread, &attr, fn, &device);
+        if (ret != 0) {
+            fprintf(stderr, "Error: pthread_create: %s\n", strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        pthread_join(pcm_devices[index].thread, NULL);
+    }
+}
@@ -0,0 +1,311 @@
+// #################### cycle engine
+//
+// The read/convert/write steps of a cycle, specialized at compile time on
+// the sample format, the channel count and the access mode, so the per block
+// arithmetic folds into constants and there is no format or access branch
+// left in the loop. channels == 0 is the generic fallback which takes the
+// channel counts from the globals and allows input and output channel
+// counts to differ. With planar access the device buffers hold one run of
+// samples per channel and so does the ringbuffer, so every channel
+// converts as one contiguous block instead of strided by the channel
+// count.
+
+// The address of the first frame at offset in an interleaved mmap area, or
+// of the sample at offset of a channel in a non-interleaved one.
+static inline uint8_t *mmap_area_frames(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, int channel = 0) {
+    return (uint8_t*)areas[channel].addr + (areas[channel].first + offset * areas[channel].step) / 8;
+}
+
+template <int format>
+static inline void block_to_float(const uint8_t *buffer, float *out, int samples) {
+    if constexpr (format == sample_format_s16) {
+        kernels->s16_to_float((const int16_t*)buffer, out, samples);
+    }
+    else if constexpr (format == sample_format_s24) {
+        kernels->s24_to_float((const int32_t*)buffer, out, samples);
+    }
+    else if constexpr (format == sample_format_s24_3) {
+        kernels->s24_3_to_float(buffer, out, samples);
+    }
+    else if constexpr (format == sample_format_float) {
+        memcpy(out, buffer, samples * sizeof(float));
+    }
+    else {
+        kernels->s32_to_float((const int32_t*)buffer, out, samples);
+    }
+}
+
+template <int format>
+static inline void block_from_float(const float *in, uint8_t *buffer, int samples) {
+    if constexpr (format == sample_format_s16) {
+        kernels->float_to_s16(in, (int16_t*)buffer, samples);
+    }
+    else if constexpr (format == sample_format_s24) {
+        kernels->float_to_s24(in, (int32_t*)buffer, samples);
+    }
+    else if constexpr (format == sample_format_s24_3) {
+        kernels->float_to_s24_3(in, buffer, samples);
+    }
+    else if constexpr (format == sample_format_float) {
+        memcpy(buffer, in, samples * sizeof(float));
+    }
+    else {
+        kernels->float_to_s32(in, (int32_t*)buffer, samples);
+    }
+}
+
+template <int format, int channels, bool mmap, bool planar>
+struct cycle_engine {
+    static constexpr int sample_bytes = sample_format_bytes(format);
+
+    static inline int device_input_channels() { return channels ? channels : input_channels; }
+    static inline int device_output_channels() { return channels ? channels : output_channels; }
+    static inline int ring_channels() { return channels ? channels : min_channels; }
+
+    // Points planes at the frames after done frames of an rw buffer of
+    // buffer_frames frames: the interleaved frames, or every channel.
+    static inline void **buffer_planes(std::vector<void*> &planes, uint8_t *buffer, int buffer_frames, int device_channels, int done) {
+        if constexpr (planar) {
+            for (int channel = 0; channel < device_channels; ++channel) {
+                planes[channel] = buffer + ((size_t)channel * buffer_frames + done) * sample_bytes;
+            }
+        }
+        else {
+            planes[0] = buffer + (size_t)done * device_channels * sample_bytes;
+        }
+        return planes.data();
+    }
+
+    // Points planes at the frames at offset of mmap areas.
+    static inline void **area_planes(std::vector<void*> &planes, const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, int device_channels) {
+        if constexpr (planar) {
+            for (int channel = 0; channel < device_channels; ++channel) {
+                planes[channel] = mmap_area_frames(areas, offset, channel);
+            }
+        }
+        else {
+            planes[0] = mmap_area_frames(areas, offset);
+        }
+        return planes.data();
+    }
+
+    // Converts frames input frames from planes (the interleaved frames, or
+    // one plane per channel) into ring after its write position and
+    // advances the write position. The frames become visible to the
+    // consumer once they are published.
+    static void to_ringbuffer(spsc_ringbuffer &ring, void *const *planes, int frames) {
+        const uint32_t position = ring.write_position;
+        // at most two runs split where the ringbuffer wraps around
+        const int first_frames = std::min(frames, ring.contiguous_frames(position));
+        if constexpr (planar) {
+            // surplus input channels are left out
+            for (int channel = 0; channel < ring_channels(); ++channel) {
+                const uint8_t *plane = (const uint8_t*)planes[channel];
+                block_to_float<format>(plane, ring.channel_samples(channel, position), first_frames);
+                block_to_float<format>(plane + first_frames * sample_bytes, ring.channel_samples(channel, position + first_frames), frames - first_frames);
+            }
+        }
+        else {
+            const uint8_t *buffer = (const uint8_t*)planes[0];
+            if (device_input_channels() == ring_channels()) {
+                // Both sides are dense.
+                block_to_float<format>(buffer, ring.frame(position), first_frames * ring_channels());
+                block_to_float<format>(buffer + first_frames * ring_channels() * sample_bytes, ring.frame(position + first_frames), (frames - first_frames) * ring_channels());
+            }
+            else {
+                for (int frame_index = 0; frame_index < frames; ++frame_index) {
+                    block_to_float<format>(buffer + frame_index * device_input_channels() * sample_bytes, ring.frame(position + frame_index), ring_channels());
+                }
+            }
+        }
+        ring.write(frames);
+    }
+
+    // Converts frames published frames from ring into output frames at
+    // planes (the interleaved frames, or one plane per channel) and
+    // consumes them.
+    static void from_ringbuffer(spsc_ringbuffer &ring, void *const *planes, int frames) {
+        const uint32_t position = ring.tail.load(std::memory_order_relaxed);
+        const int first_frames = std::min(frames, ring.contiguous_frames(position));
+        if constexpr (planar) {
+            // surplus output channels are left as they are
+            for (int channel = 0; channel < ring_channels(); ++channel) {
+                uint8_t *plane = (uint8_t*)planes[channel];
+                block_from_float<format>(ring.channel_samples(channel, position), plane, first_frames);
+                block_from_float<format>(ring.channel_samples(channel, position + first_frames), plane + first_frames * sample_bytes, frames - first_frames);
+            }
+        }
+        else {
+            uint8_t *buffer = (uint8_t*)planes[0];
+            if (device_output_channels() == ring_channels()) {
+                block_from_float<format>(ring.frame(position), buffer, first_frames * ring_channels());
+                block_from_float<format>(ring.frame(position + first_frames), buffer + first_frames * ring_channels() * sample_bytes, (frames - first_frames) * ring_channels());
+            }
+            else {
+                for (int frame_index = 0; frame_index < frames; ++frame_index) {
+                    block_from_float<format>(ring.frame(position + frame_index), buffer + frame_index * device_output_channels() * sample_bytes, ring_channels());
+                }
+            }
+        }
+        ring.consume(frames);
+    }
+
+    // Reads up to frames frames from the capture device of device into its
+    // ringbuffer, timing the read and the conversion with timer. Returns
+    // the number of frames read or a negative error code.
+    static int capture(pcm_device &device, int frames, phase_timer &timer) {
+        pcm_handle *pcm = device.capture;
+        spsc_ringbuffer &ring = device.ring;
+        int frames_read = 0;
+        while (frames_read < frames) {
+            if constexpr (mmap) {
+                const snd_pcm_channel_area_t *areas;
+                snd_pcm_uframes_t offset;
+                snd_pcm_uframes_t frames_mapped = frames - frames_read;
+
+                int ret = backend->mmap_begin(pcm, &areas, &offset, &frames_mapped);
+                timer.mark(phase_read);
+                if (ret < 0) { return ret; }
+                if (frames_mapped == 0) { break; }
+
+                to_ringbuffer(ring, area_planes(device.capture_transfer, areas, offset, device_input_channels()), frames_mapped);
+                timer.mark(phase_convert_in);
+
+                ret = backend->mmap_commit(pcm, offset, frames_mapped);
+                timer.mark(phase_read);
+                if (ret < 0) { return ret; }
+                if ((snd_pcm_uframes_t)ret != frames_mapped) { return -EPIPE; }
+
+                frames_read += ret;
+            }
+            else {
+                void **planes = buffer_planes(device.capture_transfer, device.input_buffer, device.buffer_frames, device_input_channels(), frames_read);
+                int ret;
+                if constexpr (planar) {
+                    ret = backend->readn(pcm, planes, frames - frames_read);
+                }
+                else {
+                    ret = backend->readi(pcm, planes[0], frames - frames_read);
+                }
+                timer.mark(phase_read);
+                if (ret < 0) { return ret; }
+
+                frames_read += ret;
+            }
+        }
+
+        if constexpr (!mmap) {
+            to_ringbuffer(ring, buffer_planes(device.capture_transfer, device.input_buffer, device.buffer_frames, device_input_channels(), 0), frames_read);
+            timer.mark(phase_convert_in);
+        }
+
+        return frames_read;
+    }
+
+    // Writes frames frames from the ringbuffer of device to its playback
+    // device, timing the conversion and the write with timer. Returns the
+    // number of frames written or a negative error code.
+    static int playback(pcm_device &device, int frames, phase_timer &timer) {
+        pcm_handle *pcm = device.playback;
+        spsc_ringbuffer &ring = device.ring;
+        int frames_written = 0;
+
+        if constexpr (!mmap) {
+            from_ringbuffer(ring, buffer_planes(device.playback_transfer, device.output_buffer, device.buffer_frames, device_output_channels(), 0), frames);
+            timer.mark(phase_convert_out);
+        }
+
+        while (frames_written < frames) {
+            if constexpr (mmap) {
+                const snd_pcm_channel_area_t *areas;
+                snd_pcm_uframes_t offset;
+                snd_pcm_uframes_t frames_mapped = frames - frames_written;
+
+                int ret = backend->mmap_begin(pcm, &areas, &offset, &frames_mapped);
+                timer.mark(phase_write);
+                if (ret < 0) { return ret; }
+                if (frames_mapped == 0) { break; }
+
+                from_ringbuffer(ring, area_planes(device.playback_transfer, areas, offset, device_output_channels()), frames_mapped);
+                timer.mark(phase_convert_out);
+
+                ret = backend->mmap_commit(pcm, offset, frames_mapped);
+                timer.mark(phase_write);
+                if (ret < 0) { return ret; }
+                if ((snd_pcm_uframes_t)ret != frames_mapped) { return -EPIPE; }
+
+                frames_written += ret;
+            }
+            else {
+                void **planes = buffer_planes(device.playback_transfer, device.output_buffer, device.buffer_frames, device_output_channels(), frames_written);
+                int ret;
+                if constexpr (planar) {
+                    ret = backend->writen(pcm, planes, frames - frames_written);
+                }
+                else {
+                    ret = backend->writei(pcm, planes[0], frames - frames_written);
+                }
+                timer.mark(phase_write);
+                if (ret < 0) { return ret; }
+
+                frames_written += ret;
+            }
+        }
+
+        return frames_written;
+    }
+};
+
+struct cycle_engine_functions {
+    // 0 for the generic fallback
+    int channels;
+    void (*to_ringbuffer)(spsc_ringbuffer &ring, void *const *planes, int frames);
+    void (*from_ringbuffer)(spsc_ringbuffer &ring, void *const *planes, int frames);
+    int (*capture)(pcm_device &device, int frames, phase_timer &timer);
+    int (*playback)(pcm_device &device, int frames, phase_timer &timer);
+};
+
+template <int format, int channels, bool mmap>
+static cycle_engine_functions cycle_engine_for_layout() {
+    if (planar_access) {
+        typedef cycle_engine<format, channels, mmap, true> engine;
+        return { channels, engine::to_ringbuffer, engine::from_ringbuffer, engine::capture, engine::playback };
+    }
+    typedef cycle_engine<format, channels, mmap, false> engine;
+    return { channels, engine::to_ringbuffer, engine::from_ringbuffer, engine::capture, engine::playback };
+}
+
+template <int format, int channels>
+static cycle_engine_functions cycle_engine_for_access() {
+    if (mmap_access) {
+        return cycle_engine_for_layout<format, channels, true>();
+    }
+    return cycle_engine_for_layout<format, channels, false>();
+}
+
+template <int format>
+static cycle_engine_functions cycle_engine_for_channels() {
+    if (input_channels == output_channels) {
+        switch (input_channels) {
+            case 1: return cycle_engine_for_access<format, 1>();
+            case 2: return cycle_engine_for_access<format, 2>();
+            case 8: return cycle_engine_for_access<format, 8>();
+            case 16: return cycle_engine_for_access<format, 16>();
+            case 32: return cycle_engine_for_access<format, 32>();
+            case 64: return cycle_engine_for_access<format, 64>();
+        }
+    }
+    return cycle_engine_for_access<format, 0>();
+}
+
+// Picks the instantiation matching the current sample format, channel
+// counts, access mode and layout.
+cycle_engine_functions select_cycle_engine() {
+    switch (sample_format) {
+        case sample_format_s16: return cycle_engine_for_channels<sample_format_s16>();
+        case sample_format_s24: return cycle_engine_for_channels<sample_format_s24>();
+        case sample_format_s24_3: return cycle_engine_for_channels<sample_format_s24_3>();
+        case sample_format_float: return cycle_engine_for_channels<sample_format_float>();
+    }
+    return cycle_engine_for_channels<sample_format_s32>();
+}
@@ -0,0 +1,68 @@
+// #################### fft
+//
+// In place iterative radix-2 fft on split real and imaginary arrays. The
+// twiddles of the stage with half size h are stored at [h, 2h), so the
+// butterflies of a block are unit stride loops over four arrays the
+// compiler vectorizes.
+
+struct fft_plan {
+    int size;
+    std::vector<int> bit_reverse;
+    std::vector<float> twiddle_re;
+    std::vector<float> twiddle_im;
+
+    void setup(int fft_size) {
+        size = fft_size;
+        int bits = 0;
+        while ((1 << bits) < size) { ++bits; }
+
+        bit_reverse.assign(size, 0);
+        for (int index = 0; index < size; ++index) {
+            int reversed = 0;
+            for (int bit = 0; bit < bits; ++bit) {
+                if (index & (1 << bit)) { reversed |= 1 << (bits - 1 - bit); }
+            }
+            bit_reverse[index] = reversed;
+        }
+
+        twiddle_re.assign(size, 0);
+        twiddle_im.assign(size, 0);
+        for (int half = 1; half < size; half <<= 1) {
+            for (int index = 0; index < half; ++index) {
+                const double angle = -M_PI * index / half;
+                twiddle_re[half + index] = cos(angle);
+                twiddle_im[half + index] = sin(angle);
+            }
+        }
+    }
+
+    // The forward transform. The inverse is conj(forward(conj(x))) / size.
+    void forward(float *__restrict re, float *__restrict im) const {
+        for (int index = 0; index < size; ++index) {
+            const int reversed = bit_reverse[index];
+            if (reversed > index) {
+                std::swap(re[index], re[reversed]);
+                std::swap(im[index], im[reversed]);
+            }
+        }
+
+        for (int half = 1; half < size; half <<= 1) {
+            const float *__restrict w_re = twiddle_re.data() + half;
+            const float *__restrict w_im = twiddle_im.data() + half;
+            for (int block = 0; block < size; block += 2 * half) {
+                float *__restrict a_re = re + block;
+                float *__restrict a_im = im + block;
+                float *__restrict b_re = re + block + half;
+                float *__restrict b_im = im + block + half;
+                for (int index = 0; index < half; ++index) {
+                    const float t_re = w_re[index] * b_re[index] - w_im[index] * b_im[index];
+                    const float t_im = w_re[index] * b_im[index] + w_im[index] * b_re[index];
+                    b_re[index] = a_re[index] - t_re;
+                    b_im[index] = a_im[index] - t_im;
+                    a_re[index] += t_re;
+                    a_im[index] += t_im;
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,266 @@
+// #################### log-linear histograms
+//
+// Fixed memory histograms in the spirit of HdrHistogram: values below
+// 2^sub_bucket_bits get a bucket each, every power of two range above is
+// split into 2^sub_bucket_bits linear sub-buckets, so any recorded value
+// is reproduced within 1/128 (under 1%) of itself. All counters are relaxed
+// atomics with a single writer, which costs the same as plain increments
+// on the sampling thread and lets other threads read consistent-enough
+// snapshots while sampling runs.
+
+struct hdr_histogram {
+    static const int sub_bucket_bits = 7;
+    static const int sub_buckets = 1 << sub_bucket_bits;
+    static const int num_buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+    std::atomic<uint64_t> counts[num_buckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> min;
+    std::atomic<uint64_t> max;
+
+    hdr_histogram() {
+        reset();
+    }
+
+    // Not thread safe.
+    void reset() {
+        for (int index = 0; index < num_buckets; ++index) { counts[index].store(0); }
+        count.store(0);
+        sum.store(0);
+        min.store(UINT64_MAX);
+        max.store(0);
+    }
+
+    static inline int bucket_index(uint64_t value) {
+        if (value < (uint64_t)sub_buckets) { return value; }
+        const int msb = 63 - __builtin_clzll(value);
+        const int shift = msb - sub_bucket_bits;
+        return (shift + 1) * sub_buckets + (int)((value >> shift) - sub_buckets);
+    }
+
+    // The largest value that lands in the bucket at index.
+    static inline uint64_t bucket_highest(int index) {
+        if (index < sub_buckets) { return index; }
+        const int shift = index / sub_buckets - 1;
+        const uint64_t sub_bucket = index % sub_buckets + sub_buckets;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+    // Single writer only.
+    inline void record(uint64_t value) {
+        std::atomic<uint64_t> &bucket = counts[bucket_index(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        if (value < min.load(std::memory_order_relaxed)) { min.store(value, std::memory_order_relaxed); }
+        if (value > max.load(std::memory_order_relaxed)) { max.store(value, std::memory_order_relaxed); }
+    }
+
+    // The value below which percent of the recorded values fall, within the
+    // bucket resolution. 0 if nothing was recorded.
+    uint64_t percentile(double percent) const {
+        const uint64_t total = count.load(std::memory_order_relaxed);
+        if (total == 0) { return 0; }
+
+        uint64_t rank = (uint64_t)(percent / 100.0 * total + 0.5);
+        if (rank < 1) { rank = 1; }
+
+        uint64_t seen = 0;
+        for (int index = 0; index < num_buckets; ++index) {
+            seen += counts[index].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return std::min(bucket_highest(index), max.load(std::memory_order_relaxed));
+            }
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+
+    double mean() const {
+        const uint64_t total = count.load(std::memory_order_relaxed);
+        return total ? (double)sum.load(std::memory_order_relaxed) / total : 0;
+    }
+};
+
+// #################### per sampling thread statistics
+//
+// Updated from every valid data sample. The wakeup interval is the time
+// between two consecutive valid wakeups, the wakeup jitter its absolute
+// deviation from the nominal period (period_size_frames at
+// sampling_rate_hz). The others follow the table columns of the same name.
+
+struct sample_stats {
+    enum {
+        wakeup_interval_ns,
+        wakeup_jitter_ns,
+        playback_available,
+        capture_available,
+        fill,
+        drain,
+        io_ns,
+        // only with driver timestamps
+        playback_delay,
+        capture_delay,
+        hw_lag_ns,
+        num_histograms
+    };
+
+    hdr_histogram histograms[num_histograms];
+    timespec previous_wakeup;
+    bool has_previous_wakeup;
+
+    sample_stats() :
+        previous_wakeup{0, 0},
+        has_previous_wakeup(false) {
+
+    }
+
+    // Not thread safe.
+    void reset() {
+        for (int index = 0; index < num_histograms; ++index) { histograms[index].reset(); }
+        has_previous_wakeup = false;
+    }
+
+    inline void record(const data &data_sample) {
+        if (has_previous_wakeup) {
+            int64_t interval = (data_sample.wakeup_time.tv_sec - previous_wakeup.tv_sec) * 1000000000LL + (data_sample.wakeup_time.tv_nsec - previous_wakeup.tv_nsec);
+            int64_t nominal = 1000000000LL * period_size_frames / sampling_rate_hz;
+            histograms[wakeup_interval_ns].record(interval > 0 ? interval : 0);
+            histograms[wakeup_jitter_ns].record(interval > nominal ? interval - nominal : nominal - interval);
+        }
+        previous_wakeup = data_sample.wakeup_time;
+        has_previous_wakeup = true;
+
+        histograms[playback_available].record(std::max(data_sample.playback_available, 0));
+        histograms[capture_available].record(std::max(data_sample.capture_available, 0));
+        histograms[fill].record(std::max(data_sample.fill, 0));
+        histograms[drain].record(std::max(data_sample.drain, 0));
+        histograms[io_ns].record(std::max(data_sample.io_ns, 0));
+        histograms[playback_delay].record(std::max(data_sample.playback_delay, 0));
+        histograms[capture_delay].record(std::max(data_sample.capture_delay, 0));
+        histograms[hw_lag_ns].record(std::max(data_sample.hw_lag_ns, 0));
+    }
+};
+
+const char *sample_stats_names[sample_stats::num_histograms] = {
+    "wakeup-interval-ns",
+    "wakeup-jitter-ns",
+    "avail-w",
+    "avail-r",
+    "fill",
+    "drain",
+    "io-ns",
+    "delay-w",
+    "delay-r",
+    "hw-lag-ns",
+};
+
+void print_histogram_header(FILE *file) {
+    fprintf(file, "%-20s %12s %12s %12s %12s %12s %12s %14s\n", "", "count", "min", "p50", "p99", "p99.9", "max", "mean");
+}
+
+void print_histogram(FILE *file, const char *name, const hdr_histogram &histogram) {
+    const uint64_t count = histogram.count.load(std::memory_order_relaxed);
+    const uint64_t min = count ? histogram.min.load(std::memory_order_relaxed) : 0;
+    fprintf(file, "%-20s %12lu %12lu %12lu %12lu %12lu %12lu %14.1f\n", name, count, min, histogram.percentile(50), histogram.percentile(99), histogram.percentile(99.9), histogram.max.load(std::memory_order_relaxed), histogram.mean());
+}
+
+void print_sample_stats(FILE *file, const char *title, const sample_stats &stats) {
+    fprintf(file, "%s\n", title);
+    print_histogram_header(file);
+    for (int index = 0; index < sample_stats::num_histograms; ++index) {
+        if (!driver_timestamps && index >= sample_stats::playback_delay) { break; }
+        print_histogram(file, sample_stats_names[index], stats.histograms[index]);
+    }
+}
+
+// #################### cycle phase statistics
+//
+// With --phase-timing: the durations of the phases of every valid cycle.
+
+struct phase_stats {
+    hdr_histogram histograms[trace_num_phases];
+
+    // Not thread safe.
+    void reset() {
+        for (int index = 0; index < trace_num_phases; ++index) { histograms[index].reset(); }
+    }
+
+    inline void record(const data &data_sample) {
+        for (int index = 0; index < trace_num_phases; ++index) { histograms[index].record(data_sample.phase_ns[index]); }
+    }
+};
+
+void print_phase_stats(FILE *file, const phase_stats &stats) {
+    for (int index = 0; index < trace_num_phases; ++index) {
+        const std::string name = std::string(trace_phase_names[index]) + "-ns";
+        print_histogram(file, name.c_str(), stats.histograms[index]);
+    }
+}
+
+// #################### perf counter statistics
+//
+// With --perf-counters: how far every counter advanced per valid cycle.
+
+struct perf_stats {
+    hdr_histogram histograms[trace_num_perf_counters];
+
+    // Not thread safe.
+    void reset() {
+        for (int index = 0; index < trace_num_perf_counters; ++index) { histograms[index].reset(); }
+    }
+
+    inline void record(const data &data_sample) {
+        for (int index = 0; index < trace_num_perf_counters; ++index) { histograms[index].record(data_sample.perf_deltas[index]); }
+    }
+};
+
+void print_perf_stats(FILE *file, const perf_stats &stats) {
+    for (int index = 0; index < trace_num_perf_counters; ++index) {
+        print_histogram(file, trace_perf_counter_names[index], stats.histograms[index]);
+    }
+}
+
+// #################### timer scheduling statistics
+//
+// Recorded by the tsched wait strategy at every wakeup. The wakeup error
+// is how long after the predicted moment of a device becoming ready the
+// thread observed it, the timer latency how late clock_nanosleep returned,
+// the headroom the time left until the least filled device would xrun.
+// Wakeups at which no device was ready yet are counted as early.
+
+struct tsched_stats {
+    enum {
+        wakeup_error_ns,
+        timer_latency_ns,
+        headroom_ns,
+        num_histograms
+    };
+
+    hdr_histogram histograms[num_histograms];
+    std::atomic<uint64_t> early_wakeups;
+
+    tsched_stats() :
+        early_wakeups(0) {
+
+    }
+
+    // Not thread safe.
+    void reset() {
+        for (int index = 0; index < num_histograms; ++index) { histograms[index].reset(); }
+        early_wakeups.store(0);
+    }
+};
+
+const char *tsched_stats_names[tsched_stats::num_histograms] = {
+    "wakeup-error-ns",
+    "timer-latency-ns",
+    "headroom-ns",
+};
+
+void print_tsched_stats(FILE *file, const tsched_stats &stats) {
+    for (int index = 0; index < tsched_stats::num_histograms; ++index) {
+        print_histogram(file, tsched_stats_names[index], stats.histograms[index]);
+    }
+    fprintf(file, "%-20s %12lu\n", "early-wakeups", stats.early_wakeups.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,142 @@
+// #################### live stats
+//
+// With --live-stats every sampling thread keeps the rolling counters of
+// live_format.cc next to its summary stats and publishes them after every
+// valid sample, for alsa-pcm-stats-top. The segment is created, sized and
+// populated at startup, and mlockall keeps it resident, so publishing is a
+// copy into locked shared memory: no syscall, no page fault and no lock a
+// reader could hold up the sampling thread with.
+
+std::string live_stats_name;
+live_segment *live = nullptr;
+
+static_assert(max_sampling_threads <= live_max_threads, "the live stats segment has too few thread slots");
+
+// Written by the main thread between measurements and by its sampling
+// thread during one.
+live_thread_values live_values[max_sampling_threads];
+// written by the main thread
+live_run live_current_run;
+
+// Creates /dev/shm/<live_stats_name>, or replaces what a previous run
+// left there.
+void setup_live_stats() {
+    const std::string &name = live_stats_name;
+    if (name.empty()) { return; }
+    if (name.find('/') != std::string::npos) {
+        fprintf(stderr, "Error: invalid --live-stats name: %s\n", name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    const std::string shm_name = "/" + name;
+    const int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: shm_open %s: %s\n", shm_name.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(fd, sizeof(live_segment)) != 0) {
+        fprintf(stderr, "Error: ftruncate %s: %s\n", shm_name.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    void *mapped = mmap(NULL, sizeof(live_segment), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "Error: mmap %s: %s\n", shm_name.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    memset(mapped, 0, sizeof(live_segment));
+    live = (live_segment*)mapped;
+    memcpy(live->magic, live_magic, sizeof(live->magic));
+    live->version = live_version;
+    live->bytes = sizeof(live_segment);
+
+    if (verbose) { fprintf(stderr, "Publishing live stats in /dev/shm/%s\n", name.c_str()); }
+}
+
+// The name of a sampling thread in alsa-pcm-stats-top: its device, and
+// which direction in the split mode.
+static std::string live_thread_name(int index) {
+    if (num_threads == 2) { return pcm_devices[0].name + (index == 0 ? " capture" : " playback"); }
+    return pcm_devices[index].name;
+}
+
+// Before the sampling threads of a measurement start: clears the values
+// of every thread and marks the run as running.
+void start_live_measurement(int measurement, int measurements) {
+    if (!live) { return; }
+    for (int index = 0; index < num_thread_stats; ++index) {
+        live_thread_values &values = live_values[index];
+        memset(&values, 0, sizeof(values));
+        snprintf(values.title, sizeof(values.title), "%s", live_thread_name(index).c_str());
+        live->threads[index].store(values);
+    }
+
+    live_run &run = live_current_run;
+    memset(&run, 0, sizeof(run));
+    run.pid = getpid();
+    run.state = live_state_running;
+    run.threads = num_thread_stats;
+    run.measurement = measurement;
+    run.measurements = measurements;
+    run.period_size_frames = period_size_frames;
+    run.num_periods = num_periods;
+    run.sampling_rate_hz = sampling_rate_hz;
+    run.start_ns = wait_now_ns();
+    snprintf(run.pcm_device_names, sizeof(run.pcm_device_names), "%s", pcm_device_names_joined().c_str());
+    live->run.store(run);
+}
+
+// After the sampling threads of a measurement joined.
+void stop_live_measurement() {
+    if (!live) { return; }
+    live_current_run.state = live_state_idle;
+    live->run.store(live_current_run);
+}
+
+// From the sampling thread index, before its loop.
+void attach_live_thread(int index) {
+    if (!live) { return; }
+    live_values[index].tid = syscall(SYS_gettid);
+    live->threads[index].store(live_values[index]);
+}
+
+// From the sampling thread index, for every valid sample.
+inline void live_record(int index, const data &data_sample, uint64_t xruns) {
+    if (!live) { return; }
+    live_thread_values &values = live_values[index];
+
+    const int64_t wakeup_ns = data_sample.wakeup_time.tv_sec * 1000000000LL + data_sample.wakeup_time.tv_nsec;
+    if (values.samples > 0) {
+        const int64_t interval = wakeup_ns - values.wakeup_ns;
+        const int64_t nominal = 1000000000LL * period_size_frames / sampling_rate_hz;
+        values.jitter_ns = interval > nominal ? interval - nominal : nominal - interval;
+        values.max_jitter_ns = std::max(values.max_jitter_ns, values.jitter_ns);
+        ++values.jitter_counts[live_jitter_bucket(values.jitter_ns)];
+    }
+
+    values.fill = data_sample.fill;
+    values.drain = data_sample.drain;
+    values.playback_available = data_sample.playback_available;
+    values.capture_available = data_sample.capture_available;
+    values.playback_delay = data_sample.playback_delay;
+    values.capture_delay = data_sample.capture_delay;
+    values.io_ns = data_sample.io_ns;
+    values.cycles = data_sample.cycles;
+    values.wakeup_ns = wakeup_ns;
+    values.xruns = xruns;
+    ++values.samples;
+
+    live->threads[index].store(values);
+}
+
+// At exit: tells attached viewers and removes the name, they keep their
+// mapping.
+void finish_live_stats() {
+    if (!live) { return; }
+    live_current_run.state = live_state_exited;
+    live->run.store(live_current_run);
+    shm_unlink(("/" + live_stats_name).c_str());
+    munmap(live, sizeof(live_segment));
+    live = nullptr;
+}
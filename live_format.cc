@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+// #################### live stats segment
+//
+// With --live-stats the sampling threads publish their latest sample and
+// rolling counters into a POSIX shared memory object, /dev/shm/<name>,
+// that alsa-pcm-stats-top maps read only. Every block of it is a seqlock
+// with a single writer: the writer makes the sequence odd, stores the
+// values and makes it even again, a reader copies the values and retries
+// if the sequence was odd or moved meanwhile. The writer never waits on a
+// reader and makes no syscall. Writer and readers share the host, so
+// everything is in host byte order.
+//
+// segment
+//   magic "APSLIVE", version, segment size in bytes
+//   live_run            the parameters of the current measurement
+//   live_thread_values  one per sampling thread, live_max_threads
+
+const char live_magic[8] = { 'A', 'P', 'S', 'L', 'I', 'V', 'E', 0 };
+const uint32_t live_version = 1;
+
+const int live_max_threads = 8;
+const int live_title_bytes = 48;
+const int live_device_names_bytes = 128;
+// bucket 0: no jitter, bucket b: [2^(b - 1), 2^b) ns, the last one open
+const int live_jitter_buckets = 32;
+
+enum {
+    // between the measurements of a sweep
+    live_state_idle,
+    live_state_running,
+    // the writer exited, the segment is unlinked
+    live_state_exited,
+};
+
+const char *live_state_names[] = { "idle", "running", "exited" };
+
+struct live_run {
+    int32_t pid;
+    int32_t state;
+    int32_t threads;
+    // 1-based, of the points of a sweep
+    int32_t measurement;
+    int32_t measurements;
+    int32_t period_size_frames;
+    int32_t num_periods;
+    int32_t sampling_rate_hz;
+    // CLOCK_MONOTONIC, of the start of the measurement
+    int64_t start_ns;
+    char pcm_device_names[live_device_names_bytes];
+};
+
+struct live_thread_values {
+    // the device, and in the split mode capture or playback
+    char title[live_title_bytes];
+    // for its cpu time in /proc/<pid>/task/<tid>/stat
+    int32_t tid;
+    int32_t fill;
+    int32_t drain;
+    int32_t playback_available;
+    int32_t capture_available;
+    int32_t playback_delay;
+    int32_t capture_delay;
+    int32_t io_ns;
+    // of the latest valid sample
+    uint64_t cycles;
+    int64_t wakeup_ns;
+    int64_t jitter_ns;
+    // since the start of the measurement
+    uint64_t samples;
+    uint64_t xruns;
+    int64_t max_jitter_ns;
+    uint64_t jitter_counts[live_jitter_buckets];
+};
+
+static inline int live_jitter_bucket(int64_t jitter_ns) {
+    if (jitter_ns <= 0) { return 0; }
+    return std::min(64 - __builtin_clzll((uint64_t)jitter_ns), live_jitter_buckets - 1);
+}
+
+// The jitter below which bucket lies.
+static inline int64_t live_jitter_bucket_limit_ns(int bucket) {
+    return (int64_t)1 << bucket;
+}
+
+// Values written as a whole by one writer and read by any number of
+// readers, on cache lines of their own.
+template <typename T>
+struct alignas(64) live_seqlock {
+    static_assert(sizeof(T) % sizeof(uint64_t) == 0, "seqlock values must be whole words");
+    static const int num_words = sizeof(T) / sizeof(uint64_t);
+
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint64_t> words[num_words];
+
+    // Writer only.
+    inline void store(const T &values) {
+        uint64_t source[num_words];
+        memcpy(source, &values, sizeof(T));
+
+        const uint32_t start = sequence.load(std::memory_order_relaxed);
+        sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int word = 0; word < num_words; ++word) { words[word].store(source[word], std::memory_order_relaxed); }
+        sequence.store(start + 2, std::memory_order_release);
+    }
+
+    // Whether values is a consistent copy. False while the writer is
+    // storing, try again.
+    inline bool try_load(T &values) const {
+        const uint32_t start = sequence.load(std::memory_order_acquire);
+        if (start & 1) { return false; }
+
+        uint64_t copy[num_words];
+        for (int word = 0; word < num_words; ++word) { copy[word] = words[word].load(std::memory_order_relaxed); }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) != start) { return false; }
+
+        memcpy(&values, copy, sizeof(T));
+        return true;
+    }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the live stats need lock free 64 bit atomics to be shared between processes");
+
+struct live_segment {
+    char magic[8];
+    uint32_t version;
+    uint32_t bytes;
+    live_seqlock<live_run> run;
+    live_seqlock<live_thread_values> threads[live_max_threads];
+};
@@ -0,0 +1,347 @@
+// #################### processing load
+//
+// Every processing block the capture side collects is "processed" before
+// it is published to the playback side. --load-type sleep sleeps for
+// --load percent of the real time duration of the block, which delays the
+// block but leaves the cpu, its caches and the memory bandwidth idle.
+// --load-type dsp instead runs the --dsp-chain over the block in the
+// ringbuffer in place, as often as it takes to spend --load percent of the
+// duration of the block: the cost of one pass of the chain over a block
+// is measured on this cpu before every measurement, and a fraction of a
+// pass runs the chain over that fraction of the block. The processed
+// frames are what gets played.
+//
+// The chain is a comma separated list of stages:
+//
+// fir:N     a lowpass FIR of N taps, with history across blocks
+// biquad:N  a cascade of N lowpass biquads (transposed direct form II)
+// fft:N     forward and inverse fft of N frames (N a power of two)
+//
+// Every stage has unity gain at DC, so the repeated passes are stable, and
+// denormals are flushed to zero as audio software does, so decaying
+// filter states don't slow down the passes.
+
+enum load_kind {
+    load_sleep,
+    load_dsp,
+};
+
+enum dsp_stage_kind {
+    dsp_fir,
+    dsp_biquad,
+    dsp_fft,
+};
+
+struct dsp_stage {
+    dsp_stage_kind kind;
+    int size;
+    // fir: the taps reversed, biquad: b0 b1 b2 a1 a2 of every section
+    std::vector<float> coefficients;
+    fft_plan plan;
+};
+
+std::vector<dsp_stage> dsp_stages;
+
+// The state of the chain for one device, used by its capture thread only.
+struct dsp_state {
+    int channels;
+    int block_frames;
+    // per stage and channel: the fir history or the biquad section states
+    std::vector<std::vector<float>> stage_states;
+    // the block, one channel after the other
+    std::vector<float> block;
+    std::vector<float> scratch_re;
+    std::vector<float> scratch_im;
+};
+
+dsp_state dsp_states[max_pcm_devices];
+
+// The calibration of the current measurement.
+double dsp_pass_ns = 0;
+double dsp_passes_per_block = 0;
+
+// Parses --dsp-chain into dsp_stages and computes the coefficients.
+void setup_dsp_chain(const std::string &spec) {
+    dsp_stages.clear();
+
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) { end = spec.size(); }
+        const std::string item = spec.substr(start, end - start);
+        start = end + 1;
+
+        char kind[16];
+        int size;
+        char trailing;
+        if (sscanf(item.c_str(), "%15[a-z]:%d%c", kind, &size, &trailing) != 2 || size < 1) {
+            fprintf(stderr, "Error: invalid --dsp-chain stage: '%s'\n", item.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        dsp_stage stage;
+        stage.size = size;
+        if (strcmp(kind, "fir") == 0) {
+            // a Hann windowed sinc at a quarter of the rate, normalized
+            stage.kind = dsp_fir;
+            stage.coefficients.resize(size);
+            double sum = 0;
+            for (int tap = 0; tap < size; ++tap) {
+                const double offset = tap - (size - 1) / 2.0;
+                const double sinc = (offset == 0) ? 0.5 : sin(M_PI * 0.5 * offset) / (M_PI * offset);
+                const double window = (size == 1) ? 1 : 0.5 - 0.5 * cos(2 * M_PI * tap / (size - 1));
+                stage.coefficients[size - 1 - tap] = sinc * window;
+                sum += sinc * window;
+            }
+            for (float &coefficient : stage.coefficients) { coefficient /= sum; }
+        }
+        else if (strcmp(kind, "biquad") == 0) {
+            // RBJ lowpasses spread between 0.05 and 0.4 of the rate
+            stage.kind = dsp_biquad;
+            for (int section = 0; section < size; ++section) {
+                const double frequency = 0.05 + 0.35 * (section + 0.5) / size;
+                const double omega = 2 * M_PI * frequency;
+                const double alpha = sin(omega) / (2 * M_SQRT1_2);
+                const double a0 = 1 + alpha;
+                const double b1 = (1 - cos(omega)) / a0;
+                const float section_coefficients[] = { (float)(b1 / 2), (float)b1, (float)(b1 / 2), (float)(-2 * cos(omega) / a0), (float)((1 - alpha) / a0) };
+                stage.coefficients.insert(stage.coefficients.end(), section_coefficients, section_coefficients + 5);
+            }
+        }
+        else if (strcmp(kind, "fft") == 0) {
+            if (size & (size - 1)) {
+                fprintf(stderr, "Error: the fft size of --dsp-chain must be a power of two: '%s'\n", item.c_str());
+                exit(EXIT_FAILURE);
+            }
+            stage.kind = dsp_fft;
+            stage.plan.setup(size);
+        }
+        else {
+            fprintf(stderr, "Error: unsupported --dsp-chain stage: '%s'\n", item.c_str());
+            exit(EXIT_FAILURE);
+        }
+        dsp_stages.push_back(stage);
+    }
+}
+
+// (Re)allocates the zeroed state of the chain for blocks of block_frames
+// frames of channels channels. Not real time safe.
+void allocate_dsp_state(dsp_state &state, int channels, int block_frames) {
+    state.channels = channels;
+    state.block_frames = block_frames;
+    state.stage_states.assign(dsp_stages.size() * channels, std::vector<float>());
+
+    size_t scratch_frames = block_frames;
+    for (size_t stage_index = 0; stage_index < dsp_stages.size(); ++stage_index) {
+        const dsp_stage &stage = dsp_stages[stage_index];
+        size_t state_size = 0;
+        switch (stage.kind) {
+            case dsp_fir:
+                state_size = stage.size - 1;
+                scratch_frames = std::max(scratch_frames, (size_t)(stage.size - 1 + block_frames));
+                break;
+            case dsp_biquad:
+                state_size = 2 * stage.size;
+                break;
+            case dsp_fft:
+                scratch_frames = std::max(scratch_frames, (size_t)stage.size);
+                break;
+        }
+        for (int channel = 0; channel < channels; ++channel) {
+            state.stage_states[stage_index * channels + channel].assign(state_size, 0.f);
+        }
+    }
+
+    state.block.assign((size_t)channels * block_frames, 0.f);
+    state.scratch_re.assign(scratch_frames, 0.f);
+    state.scratch_im.assign(scratch_frames, 0.f);
+}
+
+static void dsp_fir_process(const dsp_stage &stage, std::vector<float> &history, float *scratch, float *__restrict samples, int frames) {
+    const int taps = stage.size;
+    std::copy(history.begin(), history.end(), scratch);
+    std::copy(samples, samples + frames, scratch + taps - 1);
+
+    // tap by tap, so the inner loop is a unit stride multiply add over the
+    // frames that vectorizes without reordering any sums
+    std::fill(samples, samples + frames, 0.f);
+    const float *__restrict coefficients = stage.coefficients.data();
+    for (int tap = 0; tap < taps; ++tap) {
+        const float coefficient = coefficients[tap];
+        const float *__restrict input = scratch + tap;
+        for (int frame = 0; frame < frames; ++frame) {
+            samples[frame] += coefficient * input[frame];
+        }
+    }
+
+    std::copy(scratch + frames, scratch + frames + taps - 1, history.begin());
+}
+
+static void dsp_biquad_process(const dsp_stage &stage, std::vector<float> &states, float *samples, int frames) {
+    for (int section = 0; section < stage.size; ++section) {
+        const float *c = &stage.coefficients[5 * section];
+        float z1 = states[2 * section];
+        float z2 = states[2 * section + 1];
+        for (int frame = 0; frame < frames; ++frame) {
+            const float in = samples[frame];
+            const float out = c[0] * in + z1;
+            z1 = c[1] * in - c[3] * out + z2;
+            z2 = c[2] * in - c[4] * out;
+            samples[frame] = out;
+        }
+        states[2 * section] = z1;
+        states[2 * section + 1] = z2;
+    }
+}
+
+// Transforms the samples forth and back in chunks of the fft size, the
+// last chunk zero padded.
+static void dsp_fft_process(const dsp_stage &stage, float *re, float *im, float *samples, int frames) {
+    const int size = stage.size;
+    const float scale = 1.f / size;
+    for (int chunk = 0; chunk < frames; chunk += size) {
+        const int chunk_frames = std::min(size, frames - chunk);
+        std::copy(samples + chunk, samples + chunk + chunk_frames, re);
+        std::fill(re + chunk_frames, re + size, 0.f);
+        std::fill(im, im + size, 0.f);
+
+        stage.plan.forward(re, im);
+        for (int index = 0; index < size; ++index) { im[index] = -im[index]; }
+        stage.plan.forward(re, im);
+
+        for (int index = 0; index < chunk_frames; ++index) { samples[chunk + index] = re[index] * scale; }
+    }
+}
+
+// Runs the whole chain over the first frames frames of the block.
+static void dsp_chain_pass(dsp_state &state, int frames) {
+    for (int channel = 0; channel < state.channels; ++channel) {
+        float *samples = &state.block[(size_t)channel * state.block_frames];
+        for (size_t stage_index = 0; stage_index < dsp_stages.size(); ++stage_index) {
+            const dsp_stage &stage = dsp_stages[stage_index];
+            std::vector<float> &stage_state = state.stage_states[stage_index * state.channels + channel];
+            switch (stage.kind) {
+                case dsp_fir: dsp_fir_process(stage, stage_state, state.scratch_re.data(), samples, frames); break;
+                case dsp_biquad: dsp_biquad_process(stage, stage_state, samples, frames); break;
+                case dsp_fft: dsp_fft_process(stage, state.scratch_re.data(), state.scratch_im.data(), samples, frames); break;
+            }
+        }
+    }
+}
+
+// Flushes denormals to zero in the calling thread. Threads created later
+// inherit it.
+void setup_dsp_float_mode() {
+#ifdef CONVERT_X86
+    // FTZ and DAZ
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+}
+
+static inline double dsp_now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// Measures the median time of a pass of the chain over a processing block
+// with warm caches, allocates the state of every device and derives how
+// many passes make --load percent of the duration of a block.
+void calibrate_dsp_load() {
+    dsp_state &state = dsp_states[0];
+    allocate_dsp_state(state, min_channels, processing_buffer_frames);
+
+    uint64_t noise = 1;
+    std::vector<double> pass_ns;
+    for (int pass = 0; pass < 35; ++pass) {
+        // fresh noise, so the passes don't just filter silence
+        for (float &sample : state.block) {
+            noise = noise * 6364136223846793005ULL + 1442695040888963407ULL;
+            sample = (int32_t)(noise >> 32) * (0.5f / INT32_MAX);
+        }
+
+        const double start_ns = dsp_now_ns();
+        dsp_chain_pass(state, processing_buffer_frames);
+        const double end_ns = dsp_now_ns();
+        // the first passes warm up the caches
+        if (pass >= 10) { pass_ns.push_back(end_ns - start_ns); }
+    }
+    std::sort(pass_ns.begin(), pass_ns.end());
+    dsp_pass_ns = pass_ns[pass_ns.size() / 2];
+
+    const double budget_ns = 1e9 * processing_buffer_frames / sampling_rate_hz;
+    dsp_passes_per_block = sleep_percent / 100.0 * budget_ns / dsp_pass_ns;
+
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        allocate_dsp_state(dsp_states[index], min_channels, processing_buffer_frames);
+    }
+}
+
+// Runs the chain over the processing block of the device that starts at
+// the published end of its ringbuffer.
+static void apply_dsp_load(pcm_device &device) {
+    dsp_state &state = dsp_states[device.index];
+    spsc_ringbuffer &ring = device.ring;
+    const uint32_t position = ring.head.load(std::memory_order_relaxed);
+    const int frames = state.block_frames;
+    // a planar ringbuffer is copied in at most two runs per channel
+    const int first_frames = std::min(frames, ring.contiguous_frames(position));
+
+    if (ring.planar) {
+        for (int channel = 0; channel < state.channels; ++channel) {
+            float *block = &state.block[(size_t)channel * frames];
+            memcpy(block, ring.channel_samples(channel, position), first_frames * sizeof(float));
+            memcpy(block + first_frames, ring.channel_samples(channel, position + first_frames), (frames - first_frames) * sizeof(float));
+        }
+    }
+    else {
+        for (int frame = 0; frame < frames; ++frame) {
+            const float *samples = ring.frame(position + frame);
+            for (int channel = 0; channel < state.channels; ++channel) {
+                state.block[(size_t)channel * frames + frame] = samples[channel];
+            }
+        }
+    }
+
+    const int passes = (int)dsp_passes_per_block;
+    for (int pass = 0; pass < passes; ++pass) {
+        dsp_chain_pass(state, frames);
+    }
+    const int remaining_frames = (dsp_passes_per_block - passes) * frames;
+    if (remaining_frames > 0) { dsp_chain_pass(state, remaining_frames); }
+
+    if (ring.planar) {
+        for (int channel = 0; channel < state.channels; ++channel) {
+            const float *block = &state.block[(size_t)channel * frames];
+            memcpy(ring.channel_samples(channel, position), block, first_frames * sizeof(float));
+            memcpy(ring.channel_samples(channel, position + first_frames), block + first_frames, (frames - first_frames) * sizeof(float));
+        }
+    }
+    else {
+        for (int frame = 0; frame < frames; ++frame) {
+            float *samples = ring.frame(position + frame);
+            for (int channel = 0; channel < state.channels; ++channel) {
+                samples[channel] = state.block[(size_t)channel * frames + frame];
+            }
+        }
+    }
+}
+
+// Processes the next processing block of the device, which is complete
+// but not yet published.
+void apply_load(pcm_device &device) {
+    if (load_type == load_dsp) {
+        apply_dsp_load(device);
+        return;
+    }
+
+    timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1e9f * ((float)sleep_percent/100.f) * ((float)processing_buffer_frames / (float)sampling_rate_hz);
+    nanosleep(&ts, NULL);
+}
+
+void print_dsp_load(FILE *file) {
+    const double budget_ns = 1e9 * processing_buffer_frames / sampling_rate_hz;
+    fprintf(file, "dsp load: %s takes %.1f us per block of %d frames, %.2f%% of its %.1f us, %.2f passes per block for a load of %d%%\n", dsp_chain_spec.c_str(), dsp_pass_ns * 1e-3, processing_buffer_frames, 100 * dsp_pass_ns / budget_ns, budget_ns * 1e-3, dsp_passes_per_block, sleep_percent);
+}
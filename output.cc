@@ -0,0 +1,142 @@
+// #################### sample output
+//
+// The text table and the binary trace behind one set of functions, used at
+// the end of a run as well as by the stream writer. Trace records are
+// encoded into a large batch buffer and written out a megabyte at a time.
+
+const size_t trace_batch_bytes = 1024 * 1024;
+
+uint8_t *trace_batch;
+size_t trace_batch_used = 0;
+// longer with the cycle phases or the perf counters
+uint32_t output_record_bytes = trace_record_bytes;
+uint32_t output_record_fields = 0;
+
+void setup_output() {
+    output_record_fields = (phase_timing ? trace_fields_phases : 0) | (perf_counters_enabled ? trace_fields_perf_counters : 0);
+    output_record_bytes = perf_counters_enabled ? trace_perf_record_bytes : phase_timing ? trace_phase_record_bytes : trace_record_bytes;
+    if (binary_output) {
+        trace_batch = (uint8_t*)arena_allocate(trace_batch_bytes);
+    }
+}
+
+static void flush_trace_batch(FILE *file) {
+    if (trace_batch_used && fwrite(trace_batch, 1, trace_batch_used, file) != trace_batch_used) {
+        fprintf(stderr, "Error: writing trace: %s\n", strerror(errno));
+    }
+    trace_batch_used = 0;
+}
+
+void output_header(FILE *file) {
+    if (binary_output) {
+        trace_header header;
+        memset(&header, 0, sizeof(header));
+        header.version = trace_version;
+        header.header_bytes = trace_header_bytes;
+        header.record_bytes = output_record_bytes;
+        header.record_fields = output_record_fields;
+        header.period_size_frames = period_size_frames;
+        header.num_periods = num_periods;
+        header.sampling_rate_hz = sampling_rate_hz;
+        header.input_channels = input_channels;
+        header.output_channels = output_channels;
+        header.sample_bytes = sizeof_sample;
+        header.sample_format = sample_format;
+        header.processing_buffer_frames = processing_buffer_frames;
+        header.load_percent = sleep_percent;
+        header.threads = num_threads;
+        header.access = (mmap_access ? trace_access_mmap : 0) | (planar_access ? trace_access_planar : 0);
+        snprintf(header.pcm_device_name, sizeof(header.pcm_device_name), "%s", pcm_device_names_joined().c_str());
+        snprintf(header.conversion_kernels, sizeof(header.conversion_kernels), "%s", kernels->name);
+
+        trace_encode_header(header, trace_batch);
+        trace_batch_used = trace_header_bytes;
+    }
+    else if (show_header) {
+        print_header(file);
+    }
+}
+
+void output_sample(FILE *file, const data &data_sample, sample_totals &totals) {
+    if (binary_output) {
+        if (trace_batch_used + output_record_bytes > trace_batch_bytes) {
+            flush_trace_batch(file);
+        }
+
+        trace_record record;
+        record.cycles = data_sample.cycles;
+        record.tv_sec = data_sample.wakeup_time.tv_sec;
+        record.tv_nsec = data_sample.wakeup_time.tv_nsec;
+        record.type = trace_record_sample;
+        record.device = data_sample.device;
+        record.flags = (data_sample.valid ? trace_flag_valid : 0) | (data_sample.poll_pollin ? trace_flag_pollin : 0) | (data_sample.poll_pollout ? trace_flag_pollout : 0);
+        record.playback_available = data_sample.playback_available;
+        record.capture_available = data_sample.capture_available;
+        record.playback_written = data_sample.playback_written;
+        record.capture_read = data_sample.capture_read;
+        record.fill = data_sample.fill;
+        record.drain = data_sample.drain;
+        record.playback_delay = data_sample.playback_delay;
+        record.capture_delay = data_sample.capture_delay;
+        record.hw_lag_ns = data_sample.hw_lag_ns;
+        record.io_ns = data_sample.io_ns;
+        for (int phase = 0; phase < trace_num_phases; ++phase) {
+            record.phase_codes[phase] = trace_encode_duration(data_sample.phase_ns[phase]);
+        }
+        for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+            record.perf_deltas[counter] = data_sample.perf_deltas[counter];
+        }
+
+        trace_encode_record(record, trace_batch + trace_batch_used, output_record_bytes);
+        trace_batch_used += output_record_bytes;
+    }
+    else {
+        print_data_sample(file, data_sample, totals);
+    }
+}
+
+// Text tables get a comment line, which plotting tools skip.
+void output_corunner_phase(FILE *file, const corunner_phase &phase) {
+    const corunner &self = corunners[phase.corunner];
+    if (binary_output) {
+        if (trace_batch_used + output_record_bytes > trace_batch_bytes) {
+            flush_trace_batch(file);
+        }
+
+        trace_record record;
+        memset(&record, 0, sizeof(record));
+        record.cycles = phase.operations;
+        record.tv_sec = phase.time.tv_sec;
+        record.tv_nsec = phase.time.tv_nsec;
+        record.type = trace_record_corunner_phase;
+        record.flags = phase.on ? trace_flag_corunner_on : 0;
+        record.device = phase.corunner;
+        record.playback_available = self.kind;
+        record.capture_available = self.cpu;
+
+        trace_encode_record(record, trace_batch + trace_batch_used, output_record_bytes);
+        trace_batch_used += output_record_bytes;
+    }
+    else {
+        fprintf(file, "# %09ld.%09ld corunner %d %s %s\n", phase.time.tv_sec, phase.time.tv_nsec, phase.corunner, corunner_kinds[self.kind].name, phase.on ? "on" : "off");
+    }
+}
+
+// Outputs the unwritten co-runner phases that started before until, or
+// all of them if until is nullptr, in time order.
+void output_corunner_phases(FILE *file, const timespec *until) {
+    while (corunner *oldest = oldest_corunner_phase()) {
+        const corunner_phase &phase = *oldest->phases.front();
+        if (until && (phase.time.tv_sec > until->tv_sec || (phase.time.tv_sec == until->tv_sec && phase.time.tv_nsec > until->tv_nsec))) { break; }
+
+        output_corunner_phase(file, phase);
+        oldest->phases.pop();
+    }
+}
+
+void output_finish(FILE *file) {
+    if (binary_output) {
+        flush_trace_batch(file);
+    }
+    fflush(file);
+}
@@ -0,0 +1,223 @@
+// #################### perf counters
+//
+// With --perf-counters every sampling thread opens perf_event counters for
+// itself and stores how much each advanced since the previous sample:
+//
+// instructions  retired instructions
+// cycles        cpu cycles
+// llc-misses    last level cache misses
+// ctx-switches  context switches
+// migrations    cpu migrations
+// page-faults   page faults
+//
+// The hardware counters are one group, so they are scheduled together, and
+// read with rdpmc through their mmap'd control page where the kernel
+// allows user space to, which avoids a syscall per counter and cycle. The
+// software counters are another group, read with a single read(). Counters
+// the cpu or the perf_event_paranoid setting doesn't allow stay 0.
+
+enum perf_counter {
+    perf_instructions,
+    perf_cycles,
+    perf_llc_misses,
+    perf_context_switches,
+    perf_migrations,
+    perf_page_faults,
+};
+
+struct perf_counter_event {
+    uint32_t type;
+    uint64_t config;
+};
+
+// In trace_perf_counter_names order, hardware counters first.
+const perf_counter_event perf_counter_events[] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+const int perf_num_hardware_counters = perf_context_switches;
+
+// Found by setup_perf_counters.
+bool perf_counter_available[trace_num_perf_counters];
+bool perf_exclude_kernel = false;
+
+static int perf_event_open(const perf_counter_event &event, int group_fd, bool exclude_kernel) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event.type;
+    attr.config = event.config;
+    attr.exclude_kernel = exclude_kernel ? 1 : 0;
+    attr.exclude_hv = 1;
+    if (event.type == PERF_TYPE_SOFTWARE) { attr.read_format = PERF_FORMAT_GROUP; }
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+// The counters of one sampling thread. Opened by and for that thread.
+struct perf_counters {
+    int fds[trace_num_perf_counters];
+    perf_event_mmap_page *pages[trace_num_perf_counters];
+    int software_group;
+    int num_software;
+    uint64_t last[trace_num_perf_counters];
+
+    perf_counters() :
+        software_group(-1),
+        num_software(0),
+        last{} {
+
+        for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+            fds[counter] = -1;
+            pages[counter] = nullptr;
+        }
+    }
+
+    ~perf_counters() {
+        close();
+    }
+
+    // Opens the available counters for the calling thread.
+    void open() {
+        int hardware_group = -1;
+        for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+            if (!perf_counter_available[counter]) { continue; }
+
+            const perf_counter_event &event = perf_counter_events[counter];
+            const bool hardware = counter < perf_num_hardware_counters;
+            int &group = hardware ? hardware_group : software_group;
+            const int fd = perf_event_open(event, group, perf_exclude_kernel);
+            if (fd < 0) { continue; }
+
+            fds[counter] = fd;
+            if (group < 0) { group = fd; }
+            if (!hardware) {
+                ++num_software;
+                continue;
+            }
+
+            void *page = mmap(NULL, page_bytes, PROT_READ, MAP_SHARED, fd, 0);
+            if (page != MAP_FAILED) { pages[counter] = (perf_event_mmap_page*)page; }
+        }
+    }
+
+    void close() {
+        for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+            if (pages[counter]) { munmap(pages[counter], page_bytes); }
+            if (fds[counter] >= 0) { ::close(fds[counter]); }
+            pages[counter] = nullptr;
+            fds[counter] = -1;
+        }
+        software_group = -1;
+        num_software = 0;
+    }
+
+    // A hardware counter, with rdpmc if the kernel lets user space read it
+    // and it is scheduled right now.
+    inline uint64_t read_hardware(int counter) const {
+#ifdef CONVERT_X86
+        if (const perf_event_mmap_page *page = pages[counter]) {
+            while (true) {
+                const uint32_t sequence = page->lock;
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+                const uint32_t index = page->index;
+                if (!page->cap_user_rdpmc || index == 0) { break; }
+
+                const int shift = 64 - page->pmc_width;
+                const int64_t pmc = (int64_t)(__rdpmc(index - 1) << shift) >> shift;
+                const uint64_t value = page->offset + pmc;
+                std::atomic_signal_fence(std::memory_order_seq_cst);
+                if (page->lock == sequence) { return value; }
+            }
+        }
+#endif
+        uint64_t value = 0;
+        if (read(fds[counter], &value, sizeof(value)) != sizeof(value)) { return last[counter]; }
+        return value;
+    }
+
+    inline void read_all(uint64_t *values) const {
+        for (int counter = 0; counter < perf_num_hardware_counters; ++counter) {
+            values[counter] = (fds[counter] >= 0) ? read_hardware(counter) : 0;
+        }
+
+        // nr, then the values in the order the counters joined the group
+        uint64_t group[1 + trace_num_perf_counters];
+        const bool ok = software_group >= 0 && read(software_group, group, (1 + num_software) * sizeof(uint64_t)) > 0;
+        int member = 0;
+        for (int counter = perf_num_hardware_counters; counter < trace_num_perf_counters; ++counter) {
+            if (fds[counter] < 0) {
+                values[counter] = 0;
+                continue;
+            }
+            values[counter] = ok ? group[1 + member] : last[counter];
+            ++member;
+        }
+    }
+
+    // Starts counting the deltas from now.
+    void start() {
+        read_all(last);
+    }
+
+    // Stores how far every counter advanced since the last call, saturated
+    // to 32 bits.
+    inline void sample(uint32_t *deltas) {
+        uint64_t values[trace_num_perf_counters];
+        read_all(values);
+        for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+            deltas[counter] = std::min(values[counter] - last[counter], (uint64_t)UINT32_MAX);
+            last[counter] = values[counter];
+        }
+    }
+};
+
+// Marks the counters that open with exclude_kernel. Returns whether any
+// was denied by perf_event_paranoid.
+static bool probe_perf_counters(bool exclude_kernel) {
+    bool denied = false;
+    for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+        const int fd = perf_event_open(perf_counter_events[counter], -1, exclude_kernel);
+        perf_counter_available[counter] = fd >= 0;
+        if (fd >= 0) { close(fd); }
+        else if (errno == EACCES || errno == EPERM) { denied = true; }
+    }
+    return denied;
+}
+
+// Finds out which counters the cpu and the perf_event_paranoid setting
+// allow, counting the kernel too if allowed.
+void setup_perf_counters() {
+    perf_exclude_kernel = false;
+    if (probe_perf_counters(false)) {
+        perf_exclude_kernel = true;
+        probe_perf_counters(true);
+    }
+
+    std::string missing;
+    for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+        if (perf_counter_available[counter]) { continue; }
+        if (!missing.empty()) { missing += ", "; }
+        missing += trace_perf_counter_names[counter];
+    }
+    if (!missing.empty()) {
+        fprintf(stderr, "Warning: perf_event_open: %s unavailable, their columns stay 0\n", missing.c_str());
+    }
+    if (perf_exclude_kernel) {
+        fprintf(stderr, "Warning: perf_event_paranoid only allows counting user space\n");
+    }
+
+    if (verbose && (perf_counter_available[perf_instructions] || perf_counter_available[perf_cycles] || perf_counter_available[perf_llc_misses])) {
+        perf_counters probe;
+        probe.open();
+        bool rdpmc = false;
+        for (int counter = 0; counter < perf_num_hardware_counters; ++counter) {
+            if (probe.pages[counter] && probe.pages[counter]->cap_user_rdpmc) { rdpmc = true; }
+        }
+        fprintf(stderr, "Reading hardware perf counters with %s\n", rdpmc ? "rdpmc" : "read");
+    }
+}
@@ -0,0 +1,131 @@
+// #################### cycle phase timing
+//
+// With --phase-timing every sampling thread splits each cycle into the
+// phases of trace_phase_names and records how long each took:
+//
+// state        the state checks and, with --driver-timestamps, the status
+// wait         the wait strategy until a device is ready
+// revents      translating the poll revents
+// avail        the avail updates after a poll or epoll wakeup
+// read         readi, or mmap_begin and mmap_commit of the capture device
+// convert-in   the conversion of the captured frames into the ringbuffer
+// load         the --load
+// convert-out  the conversion of the ringbuffer frames for playback
+// write        writei, or mmap_begin and mmap_commit of the playback device
+// other        everything else the loop does before the sample is stored
+//
+// The phases are taken with the TSC where it runs at a constant rate,
+// converted to nanoseconds by a calibration against CLOCK_MONOTONIC_RAW at
+// startup, and otherwise with CLOCK_MONOTONIC_RAW directly. A mark costs a
+// rdtsc, about 20 cycles. Samples keep every duration in 16 bits.
+
+enum cycle_phase {
+    phase_state,
+    phase_wait,
+    phase_revents,
+    phase_avail,
+    phase_read,
+    phase_convert_in,
+    phase_load,
+    phase_convert_out,
+    phase_write,
+    phase_other,
+};
+
+bool phase_clock_tsc = false;
+double phase_clock_ns_per_tick = 1;
+
+static inline uint64_t phase_clock_now() {
+#ifdef CONVERT_X86
+    if (phase_clock_tsc) { return __rdtsc(); }
+#endif
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Uses the TSC if the cpu says it runs at a constant rate and doesn't stop
+// in idle states, and measures its rate over 20 ms.
+void setup_phase_clock() {
+#ifdef CONVERT_X86
+    bool constant_tsc = false;
+    bool nonstop_tsc = false;
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if (file) {
+        char line[4096];
+        while (fgets(line, sizeof(line), file)) {
+            if (strncmp(line, "flags", 5) != 0) { continue; }
+            constant_tsc = strstr(line, " constant_tsc") != NULL;
+            nonstop_tsc = strstr(line, " nonstop_tsc") != NULL;
+            break;
+        }
+        fclose(file);
+    }
+
+    if (constant_tsc && nonstop_tsc) {
+        timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+        const uint64_t start_ticks = __rdtsc();
+
+        timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = 20000000;
+        nanosleep(&ts, NULL);
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+        const uint64_t end_ticks = __rdtsc();
+
+        const int64_t ns = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+        phase_clock_tsc = true;
+        phase_clock_ns_per_tick = (double)ns / (end_ticks - start_ticks);
+    }
+#endif
+
+    if (verbose) {
+        if (phase_clock_tsc) {
+            fprintf(stderr, "Timing cycle phases with the TSC at %.3f MHz\n", 1e3 / phase_clock_ns_per_tick);
+        }
+        else {
+            fprintf(stderr, "Timing cycle phases with CLOCK_MONOTONIC_RAW\n");
+        }
+    }
+}
+
+// The phases of the current cycle of one sampling thread. Every mark
+// charges the time since the previous mark to a phase. Does nothing
+// without --phase-timing.
+struct phase_timer {
+    bool enabled;
+    uint64_t last;
+    uint64_t ticks[trace_num_phases];
+
+    phase_timer() :
+        enabled(false),
+        last(0),
+        ticks{} {
+
+    }
+
+    inline void start() {
+        if (!enabled) { return; }
+        last = phase_clock_now();
+        for (uint64_t &phase_ticks : ticks) { phase_ticks = 0; }
+    }
+
+    inline void mark(int phase) {
+        if (!enabled) { return; }
+        const uint64_t now = phase_clock_now();
+        ticks[phase] += now - last;
+        last = now;
+    }
+
+    // Charges the rest to phase_other and stores the durations in
+    // nanoseconds.
+    inline void finish(uint32_t *phase_ns) {
+        if (!enabled) { return; }
+        mark(phase_other);
+        for (int phase = 0; phase < trace_num_phases; ++phase) {
+            phase_ns[phase] = std::min(ticks[phase] * phase_clock_ns_per_tick, (double)UINT32_MAX);
+        }
+    }
+};
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+// #################### single producer single consumer ringbuffer
+//
+// Holds float frames of a fixed number of channels, interleaved or planar
+// (one contiguous run of samples per channel). The capacity is rounded up
+// to a power of two so the free running 32 bit positions wrap with a
+// mask. The producer converts into the frames after write_position
+// and makes them visible to the consumer with publish(), the consumer
+// reads from tail and gives the frames back with consume(). Each side's
+// position lives on its own cache line so the two threads of the split
+// mode do not bounce a shared line on every cycle.
+
+const int cache_line_bytes = 64;
+
+struct spsc_ringbuffer {
+    // written by the producer only
+    alignas(cache_line_bytes) std::atomic<uint32_t> head;
+    // converted, but not yet published frames end here. Producer private.
+    uint32_t write_position;
+
+    // written by the consumer only
+    alignas(cache_line_bytes) std::atomic<uint32_t> tail;
+
+    alignas(cache_line_bytes) float *samples;
+    int channels;
+    bool planar;
+    uint32_t capacity_frames;
+    uint32_t mask;
+
+    spsc_ringbuffer() :
+        head(0),
+        write_position(0),
+        tail(0),
+        samples(nullptr),
+        channels(0),
+        planar(false),
+        capacity_frames(0),
+        mask(0) {
+
+    }
+
+    static uint32_t capacity_for(int frames) {
+        uint32_t capacity = 1;
+        while (capacity < (uint32_t)frames) { capacity <<= 1; }
+        return capacity;
+    }
+
+    // What allocate takes from the run arena.
+    static size_t bytes_for(int frames, int frame_channels) {
+        return arena_round(sizeof(float) * capacity_for(frames) * frame_channels);
+    }
+
+    // (Re)allocates zeroed storage for at least frames frames and resets
+    // all positions. Not thread safe.
+    void allocate(int frames, int frame_channels, bool planar_layout = false) {
+        if (samples) { arena_release(samples); }
+        samples = (float*)arena_allocate(sizeof(float) * capacity_for(frames) * frame_channels);
+
+        reshape(frames, frame_channels, planar_layout);
+    }
+
+    // Lays out at least frames frames of frame_channels in the storage of
+    // an allocate at least as large and resets all positions, without
+    // zeroing. Not thread safe.
+    void reshape(int frames, int frame_channels, bool planar_layout) {
+        capacity_frames = capacity_for(frames);
+        mask = capacity_frames - 1;
+        channels = frame_channels;
+        planar = planar_layout;
+
+        reset();
+    }
+
+    // Gives the storage back. Not thread safe.
+    void release() {
+        if (samples) { arena_release(samples); }
+        samples = nullptr;
+    }
+
+    // Empties the ringbuffer. Not thread safe.
+    void reset() {
+        head.store(0);
+        write_position = 0;
+        tail.store(0);
+    }
+
+    // Interleaved layout only.
+    inline float *frame(uint32_t position) const { return samples + (position & mask) * channels; }
+
+    // Planar layout only. Runs to the end of the storage, see
+    // contiguous_frames.
+    inline float *channel_samples(int channel, uint32_t position) const { return samples + (size_t)channel * capacity_frames + (position & mask); }
+
+    // Either layout, for the paths off the conversion loops.
+    inline float &sample(uint32_t position, int channel) const {
+        return planar ? *channel_samples(channel, position) : frame(position)[channel];
+    }
+
+    // The number of frames from position to the end of the storage.
+    inline int contiguous_frames(uint32_t position) const { return capacity_frames - (position & mask); }
+
+    // ########## producer side
+
+    inline int writable() const { return capacity_frames - (write_position - tail.load(std::memory_order_acquire)); }
+
+    inline void write(int frames) { write_position += frames; }
+
+    inline void publish(int frames) { head.store(head.load(std::memory_order_relaxed) + frames, std::memory_order_release); }
+
+    // ########## consumer side
+
+    inline int readable() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed); }
+
+    inline void consume(int frames) { tail.store(tail.load(std::memory_order_relaxed) + frames, std::memory_order_release); }
+};
+
+// #################### single producer single consumer queue
+//
+// A fixed size queue of trivially copyable records with the same layout
+// rules as the ringbuffer above. push() never blocks and fails when the
+// queue is full.
+
+template <typename T>
+struct spsc_queue {
+    // written by the producer only
+    alignas(cache_line_bytes) std::atomic<uint32_t> head;
+
+    // written by the consumer only
+    alignas(cache_line_bytes) std::atomic<uint32_t> tail;
+
+    alignas(cache_line_bytes) T *items;
+    uint32_t capacity;
+    uint32_t mask;
+
+    spsc_queue() :
+        head(0),
+        tail(0),
+        items(nullptr),
+        capacity(0),
+        mask(0) {
+
+    }
+
+    static uint32_t capacity_for(int size) {
+        uint32_t capacity = 1;
+        while (capacity < (uint32_t)size) { capacity <<= 1; }
+        return capacity;
+    }
+
+    // What allocate takes from the run arena.
+    static size_t bytes_for(int size) {
+        return arena_round(sizeof(T) * capacity_for(size));
+    }
+
+    // Allocates zeroed room for at least size items. Not thread safe.
+    void allocate(int size) {
+        capacity = capacity_for(size);
+        mask = capacity - 1;
+
+        if (items) { arena_release(items); }
+        items = (T*)arena_allocate(sizeof(T) * capacity);
+
+        head.store(0);
+        tail.store(0);
+    }
+
+    // ########## producer side
+
+    inline bool push(const T &item) {
+        const uint32_t position = head.load(std::memory_order_relaxed);
+        if (position - tail.load(std::memory_order_acquire) == capacity) { return false; }
+
+        items[position & mask] = item;
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // ########## consumer side
+
+    // The oldest item or nullptr if the queue is empty.
+    inline const T *front() const {
+        const uint32_t position = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == position) { return nullptr; }
+        return &items[position & mask];
+    }
+
+    inline void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+};
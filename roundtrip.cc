@@ -0,0 +1,332 @@
+// #################### round trip latency
+//
+// With --roundtrip the played frames are no longer the captured ones: the
+// playback side overwrites every frame it takes from the ringbuffer with a
+// test signal on --roundtrip-channel (and silence on the other channels,
+// so a loopback can't feed back), repeated every --roundtrip-interval
+// frames. The capture side copies the same channel of every captured frame
+// into a tap ringbuffer. A low priority analysis thread cuts the tap into
+// one window per repetition and finds the signal in it by FFT cross
+// correlation. The offset of the peak is the latency from the playback to
+// the capture hardware pointer in frames: both devices are linked, so
+// playback frame n and capture frame n pass the hardware at the same time.
+// Add the buffer the loop keeps filled for the latency an application
+// sees.
+//
+// The latency has to stay below the interval minus the signal length or
+// the peak lands in the next window.
+
+enum roundtrip_signal_kind {
+    roundtrip_none,
+    roundtrip_impulse,
+    roundtrip_mls,
+    roundtrip_chirp,
+};
+
+const char *roundtrip_signal_names[] = { "none", "impulse", "mls", "chirp" };
+const int num_roundtrip_signals = sizeof(roundtrip_signal_names) / sizeof(roundtrip_signal_names[0]);
+
+// Returns -1 for unknown names.
+int find_roundtrip_signal(const std::string &name) {
+    for (int index = 0; index < num_roundtrip_signals; ++index) {
+        if (name == roundtrip_signal_names[index]) { return index; }
+    }
+    return -1;
+}
+
+// Below this normalized correlation a window counts as missed.
+const float roundtrip_min_score = 0.3f;
+
+// ########## test signals
+
+static void make_roundtrip_impulse(std::vector<float> &signal) {
+    signal.assign(1, 0.5f);
+}
+
+// A maximum length sequence of the longest order that fits length, from a
+// Galois LFSR, at +-0.25.
+static void make_roundtrip_mls(std::vector<float> &signal, int length) {
+    // maximal length feedback masks for the orders 2 to 20
+    const uint32_t masks[] = { 0x3, 0x6, 0xc, 0x14, 0x30, 0x60, 0xb8, 0x110, 0x240, 0x500, 0x829, 0x100d, 0x2015, 0x6000, 0xd008, 0x12000, 0x20400, 0x40023, 0x90000 };
+    int order = 2;
+    while (order < 20 && (1 << (order + 1)) - 1 <= length) { ++order; }
+
+    uint32_t state = 1;
+    signal.resize((1 << order) - 1);
+    for (float &sample : signal) {
+        sample = (state & 1) ? 0.25f : -0.25f;
+        state = (state >> 1) ^ ((state & 1) ? masks[order - 2] : 0);
+    }
+}
+
+// A linear sweep from 100 hz to 0.45 * rate at 0.5 with 2 ms raised cosine
+// fades.
+static void make_roundtrip_chirp(std::vector<float> &signal, int length) {
+    const double start_hz = 100;
+    const double end_hz = 0.45 * sampling_rate_hz;
+    const double seconds = (double)length / sampling_rate_hz;
+    const int fade_frames = std::min(sampling_rate_hz / 500, length / 2);
+
+    signal.resize(length);
+    for (int index = 0; index < length; ++index) {
+        const double time = (double)index / sampling_rate_hz;
+        const double phase = 2 * M_PI * (start_hz * time + (end_hz - start_hz) * time * time / (2 * seconds));
+        double gain = 0.5;
+        const int edge = std::min(index, length - 1 - index);
+        if (edge < fade_frames) { gain *= 0.5 - 0.5 * cos(M_PI * edge / fade_frames); }
+        signal[index] = gain * sin(phase);
+    }
+}
+
+// ########## state
+
+struct roundtrip_result {
+    int repetition;
+    int latency_frames;
+    float score;
+};
+
+struct roundtrip_state {
+    std::vector<float> signal;
+    double signal_norm;
+    uint64_t first_emission;
+
+    // capture channel copies, written by the thread that captures
+    spsc_ringbuffer tap;
+    std::atomic<bool> tap_overrun;
+
+    fft_plan plan;
+    std::vector<float> signal_re;
+    std::vector<float> signal_im;
+    std::vector<float> window_re;
+    std::vector<float> window_im;
+    std::vector<double> window_energy;
+
+    std::vector<roundtrip_result> results;
+    pthread_t thread;
+    std::atomic<bool> stop;
+};
+
+roundtrip_state roundtrip_run;
+
+// Overwrites the frames frames the playback side consumes next from ring
+// with the test signal. position is the number of frames played before
+// them.
+void roundtrip_inject(spsc_ringbuffer &ring, uint64_t position, int frames) {
+    const uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    const int signal_frames = roundtrip_run.signal.size();
+
+    for (int index = 0; index < frames; ++index) {
+        for (int channel = 0; channel < ring.channels; ++channel) { ring.sample(tail + index, channel) = 0; }
+
+        const uint64_t frame_position = position + index;
+        if (frame_position < roundtrip_run.first_emission) { continue; }
+        const uint64_t phase = (frame_position - roundtrip_run.first_emission) % roundtrip_interval_frames;
+        if (phase < (uint64_t)signal_frames) { ring.sample(tail + index, roundtrip_channel) = roundtrip_run.signal[phase]; }
+    }
+}
+
+// Copies the round trip channel of the frames frames just converted into
+// ring to the tap. Once the analysis falls so far behind that
+// the tap is full it stops tapping for the rest of the measurement.
+void roundtrip_tap(const spsc_ringbuffer &ring, int frames) {
+    spsc_ringbuffer &tap = roundtrip_run.tap;
+    if (roundtrip_run.tap_overrun.load(std::memory_order_relaxed)) { return; }
+    if (tap.writable() < frames) {
+        roundtrip_run.tap_overrun.store(true, std::memory_order_relaxed);
+        return;
+    }
+
+    const uint32_t position = ring.write_position - frames;
+    for (int index = 0; index < frames; ++index) {
+        *tap.frame(tap.write_position + index) = ring.sample(position + index, roundtrip_channel);
+    }
+    tap.write(frames);
+    tap.publish(frames);
+}
+
+// Correlates the oldest interval of the tap with the signal and consumes
+// it. Returns the offset of the strongest match and its normalized
+// correlation as score.
+static roundtrip_result roundtrip_analyze_window(int repetition) {
+    roundtrip_state &state = roundtrip_run;
+    spsc_ringbuffer &tap = state.tap;
+    const int size = state.plan.size;
+    const int signal_frames = state.signal.size();
+    const uint32_t tail = tap.tail.load(std::memory_order_relaxed);
+
+    std::fill(state.window_re.begin(), state.window_re.end(), 0.f);
+    std::fill(state.window_im.begin(), state.window_im.end(), 0.f);
+    state.window_energy[0] = 0;
+    for (int index = 0; index < roundtrip_interval_frames; ++index) {
+        const float sample = *tap.frame(tail + index);
+        state.window_re[index] = sample;
+        state.window_energy[index + 1] = state.window_energy[index] + (double)sample * sample;
+    }
+    tap.consume(roundtrip_interval_frames);
+
+    // window * conj(signal) in the frequency domain is the correlation.
+    // Conjugating the product as well leaves the inverse as a forward
+    // transform.
+    state.plan.forward(state.window_re.data(), state.window_im.data());
+    {
+        float *__restrict re = state.window_re.data();
+        float *__restrict im = state.window_im.data();
+        const float *__restrict s_re = state.signal_re.data();
+        const float *__restrict s_im = state.signal_im.data();
+        for (int index = 0; index < size; ++index) {
+            const float product_re = re[index] * s_re[index] + im[index] * s_im[index];
+            const float product_im = im[index] * s_re[index] - re[index] * s_im[index];
+            re[index] = product_re;
+            im[index] = -product_im;
+        }
+    }
+    state.plan.forward(state.window_re.data(), state.window_im.data());
+
+    // the window is zero padded to at least the interval, so lags up to
+    // interval - signal don't wrap around
+    roundtrip_result result = { repetition, -1, 0.f };
+    for (int lag = 0; lag <= roundtrip_interval_frames - signal_frames; ++lag) {
+        const double energy = state.window_energy[lag + signal_frames] - state.window_energy[lag];
+        if (energy <= 0) { continue; }
+        // a loopback may invert the polarity
+        const float score = fabs(state.window_re[lag]) / size / (state.signal_norm * sqrt(energy));
+        if (score > result.score) {
+            result.score = score;
+            result.latency_frames = lag;
+        }
+    }
+    return result;
+}
+
+static void print_roundtrip_result(FILE *file, const roundtrip_result &result) {
+    if (result.score < roundtrip_min_score) {
+        fprintf(file, "Roundtrip %d: not detected (score %.2f)\n", result.repetition, result.score);
+        return;
+    }
+    const int total_frames = result.latency_frames + buffer_size_frames;
+    fprintf(file, "Roundtrip %d: %d frames (%.3f ms), %d frames (%.3f ms) with the buffer, score %.2f\n", result.repetition, result.latency_frames, 1000. * result.latency_frames / sampling_rate_hz, total_frames, 1000. * total_frames / sampling_rate_hz, result.score);
+}
+
+static void *roundtrip_thread_main(void *) {
+    roundtrip_state &state = roundtrip_run;
+    spsc_ringbuffer &tap = state.tap;
+    uint64_t position = 0;
+
+    while (true) {
+        // read the flag first so no complete window is missed
+        bool stopping = state.stop.load();
+
+        if (position < state.first_emission) {
+            const int skipped = std::min((uint64_t)tap.readable(), state.first_emission - position);
+            tap.consume(skipped);
+            position += skipped;
+        }
+
+        while (position >= state.first_emission && tap.readable() >= roundtrip_interval_frames) {
+            roundtrip_result result = roundtrip_analyze_window(state.results.size() + 1);
+            position += roundtrip_interval_frames;
+            state.results.push_back(result);
+            print_roundtrip_result(stderr, result);
+        }
+
+        if (stopping) { break; }
+
+        timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = 10000000;
+        nanosleep(&ts, NULL);
+    }
+
+    return NULL;
+}
+
+// Builds the signal and its transform and starts the analysis thread with
+// SCHED_OTHER for one measurement. Playback frame buffer_size_frames is
+// the first one that goes through the ringbuffer, so the first
+// repetition starts at the next multiple of the interval.
+void start_roundtrip(int signal_kind) {
+    roundtrip_state &state = roundtrip_run;
+
+    switch (signal_kind) {
+        case roundtrip_impulse: make_roundtrip_impulse(state.signal); break;
+        case roundtrip_mls: make_roundtrip_mls(state.signal, roundtrip_signal_frames); break;
+        default: make_roundtrip_chirp(state.signal, roundtrip_signal_frames); break;
+    }
+
+    state.signal_norm = 0;
+    for (float sample : state.signal) { state.signal_norm += (double)sample * sample; }
+    state.signal_norm = sqrt(state.signal_norm);
+
+    state.first_emission = (buffer_size_frames + roundtrip_interval_frames - 1) / roundtrip_interval_frames * roundtrip_interval_frames;
+
+    int size = 1;
+    while (size < roundtrip_interval_frames) { size <<= 1; }
+    state.plan.setup(size);
+
+    state.signal_re.assign(size, 0.f);
+    state.signal_im.assign(size, 0.f);
+    std::copy(state.signal.begin(), state.signal.end(), state.signal_re.begin());
+    state.plan.forward(state.signal_re.data(), state.signal_im.data());
+
+    state.window_re.assign(size, 0.f);
+    state.window_im.assign(size, 0.f);
+    state.window_energy.assign(roundtrip_interval_frames + 1, 0.);
+
+    // a few seconds of slack for the analysis
+    state.tap.allocate(std::max(4 * roundtrip_interval_frames, 4 * sampling_rate_hz), 1);
+    state.tap_overrun.store(false);
+    state.results.clear();
+    state.results.reserve(1024);
+    state.stop.store(false);
+
+    if (verbose) { fprintf(stderr, "Round trip %s signal of %zu frames every %d frames, fft size %d\n", roundtrip_signal_names[signal_kind], state.signal.size(), roundtrip_interval_frames, size); }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    sched_param param;
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+
+    int ret = pthread_create(&state.thread, &attr, roundtrip_thread_main, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Error: pthread_create: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+// Lets the analysis finish the complete windows and joins it.
+void stop_roundtrip() {
+    roundtrip_run.stop.store(true);
+    pthread_join(roundtrip_run.thread, NULL);
+
+    if (roundtrip_run.tap_overrun.load()) {
+        fprintf(stderr, "Warning: the round trip analysis fell behind, the later repetitions were not analyzed\n");
+    }
+}
+
+void print_roundtrip_summary(FILE *file) {
+    const std::vector<roundtrip_result> &results = roundtrip_run.results;
+    int detected = 0;
+    int min_frames = INT32_MAX;
+    int max_frames = 0;
+    double sum_frames = 0;
+    for (const roundtrip_result &result : results) {
+        if (result.score < roundtrip_min_score) { continue; }
+        ++detected;
+        min_frames = std::min(min_frames, result.latency_frames);
+        max_frames = std::max(max_frames, result.latency_frames);
+        sum_frames += result.latency_frames;
+    }
+
+    if (!detected) {
+        fprintf(file, "roundtrip: detected in 0 of %zu repetitions\n", results.size());
+        return;
+    }
+    fprintf(file, "roundtrip: detected in %d of %zu repetitions, latency min %d max %d mean %.1f frames, plus %d frames of buffer\n", detected, results.size(), min_frames, max_frames, sum_frames / detected, buffer_size_frames);
+}
@@ -0,0 +1,362 @@
+// #################### compact sample storage
+//
+// The samples kept for the end-of-run table are stored column by column
+// instead of as an array of struct data, so long runs on small boards
+// don't have to lock hundreds of megabytes:
+//
+// - wakeup times and cycles as 32 bit deltas to the previous sample, with
+//   the rare delta that doesn't fit (the first one, or a stall of over four
+//   seconds) escaped into a side list,
+// - the valid/POLLIN/POLLOUT flags packed into one byte,
+// - the frame counts as 16 bit values whenever the buffer size fits, the
+//   signed driver delays zig-zag coded so they fit as well, the
+//   nanosecond durations as 32 bit values.
+//
+// That is 35 instead of 152 bytes per sample in the common case, plus 20
+// for the 16 bit phase durations with --phase-timing and 24 for the perf
+// counter deltas with --perf-counters. Samples are only expanded back into
+// struct data while writing the output. The columns live in the
+// measurement part of the run arena.
+
+const uint32_t delta_escape = UINT32_MAX;
+
+// Room for size values of type T in the run arena, or nullptr for none.
+template <typename T>
+static T *allocate_column(size_t size) {
+    return size ? (T*)arena_allocate(size * sizeof(T)) : nullptr;
+}
+
+template <typename T>
+static size_t column_bytes(size_t size) {
+    return size ? arena_round(size * sizeof(T)) : 0;
+}
+
+struct delta_column {
+    uint32_t *deltas;
+    std::vector<uint64_t> escapes;
+    uint64_t last;
+
+    delta_column() :
+        deltas(nullptr),
+        last(0) {
+
+    }
+
+    void allocate(int size) {
+        deltas = allocate_column<uint32_t>(size);
+        escapes.clear();
+        // only grows past this on a badly broken run
+        escapes.reserve(1024);
+        last = 0;
+    }
+
+    inline void store(int index, uint64_t value) {
+        const uint64_t delta = value - last;
+        if (delta < delta_escape) {
+            deltas[index] = delta;
+        }
+        else {
+            deltas[index] = delta_escape;
+            escapes.push_back(delta);
+        }
+        last = value;
+    }
+};
+
+// Decodes a delta_column front to back.
+struct delta_column_reader {
+    const delta_column *column;
+    uint64_t value;
+    size_t escape_index;
+
+    delta_column_reader(const delta_column &column) :
+        column(&column),
+        value(0),
+        escape_index(0) {
+
+    }
+
+    inline uint64_t next(int index) {
+        const uint32_t delta = column->deltas[index];
+        value += (delta == delta_escape) ? column->escapes[escape_index++] : delta;
+        return value;
+    }
+};
+
+// Frame counts up to max_value, 16 bit wide if that fits. Unsigned
+// columns keep values from 0, signed ones from -max_value, zig-zag coded
+// (0, -1, 1, -2, ...) so small magnitudes of either sign stay narrow.
+// Values out of range saturate.
+struct count_column {
+    bool narrow;
+    bool is_signed;
+    uint16_t *narrow_values;
+    uint32_t *wide_values;
+
+    count_column() :
+        narrow(true),
+        is_signed(false),
+        narrow_values(nullptr),
+        wide_values(nullptr) {
+
+    }
+
+    static bool fits_narrow(int max_value, bool is_signed) {
+        return (is_signed ? 2 * (int64_t)max_value + 1 : max_value) <= UINT16_MAX;
+    }
+
+    static size_t bytes_for(int size, int max_value, bool is_signed) {
+        return fits_narrow(max_value, is_signed) ? column_bytes<uint16_t>(size) : column_bytes<uint32_t>(size);
+    }
+
+    void allocate(int size, int max_value, bool signed_values) {
+        is_signed = signed_values;
+        narrow = fits_narrow(max_value, is_signed);
+        narrow_values = allocate_column<uint16_t>(narrow ? size : 0);
+        wide_values = allocate_column<uint32_t>(narrow ? 0 : size);
+    }
+
+    inline void store(int index, int value) {
+        if (is_signed) {
+            if (narrow) { value = std::min(std::max(value, (int)INT16_MIN), (int)INT16_MAX); }
+            const uint32_t code = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+            if (narrow) { narrow_values[index] = code; }
+            else { wide_values[index] = code; }
+            return;
+        }
+
+        value = std::max(value, 0);
+        if (narrow) {
+            narrow_values[index] = std::min(value, (int)UINT16_MAX);
+        }
+        else {
+            wide_values[index] = value;
+        }
+    }
+
+    inline int load(int index) const {
+        const uint32_t value = narrow ? narrow_values[index] : wide_values[index];
+        if (is_signed) { return (int)(value >> 1) ^ -(int)(value & 1); }
+        return value;
+    }
+};
+
+struct sample_store {
+    enum {
+        flag_valid = 1,
+        flag_pollin = 2,
+        flag_pollout = 4,
+    };
+
+    enum {
+        playback_available,
+        capture_available,
+        playback_written,
+        capture_read,
+        fill,
+        drain,
+        playback_delay,
+        capture_delay,
+        device_index,
+        // nanoseconds
+        hw_lag_ns,
+        io_ns,
+        num_count_columns
+    };
+
+    int capacity;
+    int count;
+    int max_frames;
+    delta_column wakeup_ns;
+    delta_column cycles;
+    uint8_t *flags;
+    count_column counts[num_count_columns];
+    // trace_num_phases per sample, only with --phase-timing
+    uint16_t *phase_codes;
+    // trace_num_perf_counters per sample, only with --perf-counters
+    uint32_t *perf_deltas;
+
+    sample_store() :
+        capacity(0),
+        count(0),
+        max_frames(0),
+        flags(nullptr),
+        phase_codes(nullptr),
+        perf_deltas(nullptr) {
+
+    }
+
+    // The driver delays go negative around xruns.
+    static bool is_signed_column(int column) {
+        return column == playback_delay || column == capture_delay;
+    }
+
+    // What allocate takes from the run arena.
+    static size_t bytes_for(int size, int frames) {
+        size_t bytes = 2 * column_bytes<uint32_t>(size) + column_bytes<uint8_t>(size);
+        for (int column = 0; column < num_count_columns; ++column) {
+            bytes += count_column::bytes_for(size, column >= hw_lag_ns ? INT32_MAX : frames, is_signed_column(column));
+        }
+        bytes += column_bytes<uint16_t>(phase_timing ? (size_t)size * trace_num_phases : 0);
+        bytes += column_bytes<uint32_t>(perf_counters_enabled ? (size_t)size * trace_num_perf_counters : 0);
+        return bytes;
+    }
+
+    // Room for size samples with frame counts up to frames.
+    void allocate(int size, int frames) {
+        capacity = size;
+        count = 0;
+        max_frames = frames;
+        wakeup_ns.allocate(size);
+        cycles.allocate(size);
+        flags = allocate_column<uint8_t>(size);
+        for (int column = 0; column < num_count_columns; ++column) {
+            counts[column].allocate(size, column >= hw_lag_ns ? INT32_MAX : max_frames, is_signed_column(column));
+        }
+        phase_codes = allocate_column<uint16_t>(phase_timing ? (size_t)size * trace_num_phases : 0);
+        perf_deltas = allocate_column<uint32_t>(perf_counters_enabled ? (size_t)size * trace_num_perf_counters : 0);
+    }
+
+    // Appends a sample. Samples must come in wakeup time order.
+    inline void push(const data &data_sample) {
+        const int index = count++;
+        wakeup_ns.store(index, data_sample.wakeup_time.tv_sec * 1000000000ULL + data_sample.wakeup_time.tv_nsec);
+        cycles.store(index, data_sample.cycles);
+        flags[index] = (data_sample.valid ? flag_valid : 0) | (data_sample.poll_pollin ? flag_pollin : 0) | (data_sample.poll_pollout ? flag_pollout : 0);
+        counts[playback_available].store(index, data_sample.playback_available);
+        counts[capture_available].store(index, data_sample.capture_available);
+        counts[playback_written].store(index, data_sample.playback_written);
+        counts[capture_read].store(index, data_sample.capture_read);
+        counts[fill].store(index, data_sample.fill);
+        counts[drain].store(index, data_sample.drain);
+        counts[playback_delay].store(index, data_sample.playback_delay);
+        counts[capture_delay].store(index, data_sample.capture_delay);
+        counts[device_index].store(index, data_sample.device);
+        counts[hw_lag_ns].store(index, data_sample.hw_lag_ns);
+        counts[io_ns].store(index, data_sample.io_ns);
+        if (phase_codes) {
+            uint16_t *codes = &phase_codes[(size_t)index * trace_num_phases];
+            for (int phase = 0; phase < trace_num_phases; ++phase) { codes[phase] = trace_encode_duration(data_sample.phase_ns[phase]); }
+        }
+        if (perf_deltas) {
+            std::copy(data_sample.perf_deltas, data_sample.perf_deltas + trace_num_perf_counters, &perf_deltas[(size_t)index * trace_num_perf_counters]);
+        }
+    }
+
+    size_t bytes() const {
+        return bytes_for(capacity, max_frames);
+    }
+};
+
+// Expands the samples of a store back into struct data, front to back.
+struct sample_store_reader {
+    const sample_store *store;
+    int index;
+    delta_column_reader wakeup_ns;
+    delta_column_reader cycles;
+    data current;
+
+    sample_store_reader(const sample_store &store) :
+        store(&store),
+        index(0),
+        wakeup_ns(store.wakeup_ns),
+        cycles(store.cycles) {
+
+        advance();
+    }
+
+    bool done() const {
+        return index > store->count;
+    }
+
+    // Decodes the next sample into current.
+    void advance() {
+        if (index < store->count) {
+            const uint64_t ns = wakeup_ns.next(index);
+            current.wakeup_time.tv_sec = ns / 1000000000ULL;
+            current.wakeup_time.tv_nsec = ns % 1000000000ULL;
+            current.cycles = cycles.next(index);
+            const uint8_t sample_flags = store->flags[index];
+            current.valid = (sample_flags & sample_store::flag_valid) ? 1 : 0;
+            current.poll_pollin = (sample_flags & sample_store::flag_pollin) ? 1 : 0;
+            current.poll_pollout = (sample_flags & sample_store::flag_pollout) ? 1 : 0;
+            current.playback_available = store->counts[sample_store::playback_available].load(index);
+            current.capture_available = store->counts[sample_store::capture_available].load(index);
+            current.playback_written = store->counts[sample_store::playback_written].load(index);
+            current.capture_read = store->counts[sample_store::capture_read].load(index);
+            current.fill = store->counts[sample_store::fill].load(index);
+            current.drain = store->counts[sample_store::drain].load(index);
+            current.playback_delay = store->counts[sample_store::playback_delay].load(index);
+            current.capture_delay = store->counts[sample_store::capture_delay].load(index);
+            current.device = store->counts[sample_store::device_index].load(index);
+            current.hw_lag_ns = store->counts[sample_store::hw_lag_ns].load(index);
+            current.io_ns = store->counts[sample_store::io_ns].load(index);
+            if (store->phase_codes) {
+                const uint16_t *codes = &store->phase_codes[(size_t)index * trace_num_phases];
+                for (int phase = 0; phase < trace_num_phases; ++phase) { current.phase_ns[phase] = trace_decode_duration(codes[phase]); }
+            }
+            if (store->perf_deltas) {
+                const uint32_t *deltas = &store->perf_deltas[(size_t)index * trace_num_perf_counters];
+                std::copy(deltas, deltas + trace_num_perf_counters, current.perf_deltas);
+            }
+        }
+        ++index;
+    }
+};
+
+// One store per sampling thread, like the sample streams, merged into one
+// timeline on output.
+sample_store sample_stores[max_sampling_threads];
+int num_sample_stores = 0;
+
+void setup_sample_stores(int stores, int size, int max_frames) {
+    num_sample_stores = stores;
+    for (int index = 0; index < num_sample_stores; ++index) {
+        sample_stores[index].allocate(size, max_frames);
+    }
+}
+
+size_t sample_stores_bytes() {
+    size_t total = 0;
+    for (int index = 0; index < num_sample_stores; ++index) { total += sample_stores[index].bytes(); }
+    return total;
+}
+
+// Outputs the samples of all stores merged by wakeup time, with the phases
+// of the co-runners in between. A single thread run that ended before
+// filling its store is terminated by one invalid sample, as the table
+// always has been.
+void output_sample_stores(FILE *file) {
+    std::vector<sample_store_reader> readers;
+    for (int index = 0; index < num_sample_stores; ++index) {
+        readers.emplace_back(sample_stores[index]);
+    }
+
+    sample_totals totals;
+
+    while (true) {
+        sample_store_reader *oldest = nullptr;
+        for (sample_store_reader &reader : readers) {
+            if (reader.done()) { continue; }
+            if (!oldest) { oldest = &reader; continue; }
+
+            const timespec &candidate = reader.current.wakeup_time;
+            const timespec &current = oldest->current.wakeup_time;
+            if (candidate.tv_sec < current.tv_sec || (candidate.tv_sec == current.tv_sec && candidate.tv_nsec < current.tv_nsec)) {
+                oldest = &reader;
+            }
+        }
+
+        if (!oldest) { break; }
+
+        output_corunner_phases(file, &oldest->current.wakeup_time);
+        output_sample(file, oldest->current, totals);
+        oldest->advance();
+    }
+
+    output_corunner_phases(file, nullptr);
+
+    if (num_sample_stores == 1 && sample_stores[0].count < sample_stores[0].capacity) {
+        output_sample(file, data(), totals);
+    }
+}
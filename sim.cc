@@ -0,0 +1,523 @@
+// #################### simulated pcm device
+//
+// A pcm device without hardware for headless machines. Once started, the
+// hardware pointer advances by one burst at every burst boundary of
+// CLOCK_MONOTONIC at the configured rate, each boundary but the first late
+// by up to sim_jitter_us of pseudo random jitter. A burst is a period, or
+// a millisecond with period wakeups disabled (tsched), like the transfers
+// of a USB interface. Every device owns a timerfd that is armed for the
+// moment avail reaches avail_min, or only for xruns without period
+// wakeups, so poll based waiting works unchanged. Linked devices start,
+// stop and xrun together. Xruns happen when the application falls behind,
+// as on hardware, and are additionally injected every sim_xrun_interval
+// periods. The device clock runs sim_drift_ppm fast against
+// CLOCK_MONOTONIC. Captured frames are silence, or with sim_loopback_frames
+// >= 0 the frames the linked playback device played that many frames
+// earlier, like a loopback cable: playback and capture frame n pass the
+// linked hardware pointers at the same time. With planar access the buffer
+// holds one run of buffer_frames samples per channel.
+
+struct sim_pcm {
+    snd_pcm_stream_t stream;
+    snd_pcm_state_t state;
+    int timer_fd;
+    sim_pcm *linked;
+
+    int channels;
+    int frame_bytes;
+    bool planar;
+    snd_pcm_uframes_t buffer_frames;
+    snd_pcm_uframes_t period_frames;
+    snd_pcm_uframes_t burst_frames;
+    bool period_wakeup;
+    uint8_t *buffer;
+    std::vector<snd_pcm_channel_area_t> areas;
+    // the application buffers of the current readi, writei, readn or writen
+    std::vector<snd_pcm_channel_area_t> transfer_areas;
+    // the latest played frames by position, for the loopback
+    std::vector<uint8_t> history;
+    uint64_t history_frames;
+
+    int64_t start_ns;
+    int64_t jitter_ns;
+    // monotonic nanoseconds per nominal nanosecond of the device clock
+    double clock_scale;
+    uint64_t appl_ptr;
+    uint64_t xrun_interval_bursts;
+    uint64_t next_xrun_burst;
+};
+
+static inline sim_pcm *sim(pcm_handle *pcm) { return (sim_pcm*)pcm; }
+
+static inline int64_t sim_now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// The nominal time of frame frames after the start, split so it can't
+// overflow.
+static inline int64_t sim_frames_ns(uint64_t frames) {
+    return (frames / sampling_rate_hz) * 1000000000LL + (frames % sampling_rate_hz) * 1000000000LL / sampling_rate_hz;
+}
+
+static inline uint64_t sim_ns_frames(int64_t ns) {
+    return (ns / 1000000000LL) * sampling_rate_hz + (ns % 1000000000LL) * sampling_rate_hz / 1000000000LL;
+}
+
+// The same jitter every time a burst boundary is looked at (splitmix64).
+static inline int64_t sim_jitter(const sim_pcm &pcm, uint64_t burst) {
+    if (pcm.jitter_ns == 0 || burst == 0) { return 0; }
+    uint64_t value = burst + 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value % (pcm.jitter_ns + 1);
+}
+
+static inline int64_t sim_burst_time(const sim_pcm &pcm, uint64_t burst) {
+    return pcm.start_ns + (int64_t)(sim_frames_ns(burst * pcm.burst_frames) * pcm.clock_scale) + sim_jitter(pcm, burst);
+}
+
+// The number of the last burst boundary that has passed at now_ns.
+static inline uint64_t sim_current_burst(const sim_pcm &pcm, int64_t now_ns) {
+    if (now_ns <= pcm.start_ns) { return 0; }
+    uint64_t burst = sim_ns_frames((now_ns - pcm.start_ns) / pcm.clock_scale) / pcm.burst_frames;
+    // the jitter is less than a burst, so at most the latest boundary is
+    // still pending
+    if (burst > 0 && sim_burst_time(pcm, burst) > now_ns) { --burst; }
+    return burst;
+}
+
+// The address of sample offset of the channel of area.
+static inline uint8_t *sim_area_sample(const snd_pcm_channel_area_t &area, snd_pcm_uframes_t offset) {
+    return (uint8_t*)area.addr + (area.first + offset * area.step) / 8;
+}
+
+// Describes the application buffers of a transfer as areas: one
+// interleaved buffer for readi and writei, one per channel for readn and
+// writen.
+static const snd_pcm_channel_area_t *sim_transfer_areas(sim_pcm &pcm, void *const *buffers) {
+    for (int channel = 0; channel < pcm.channels; ++channel) {
+        snd_pcm_channel_area_t &area = pcm.transfer_areas[channel];
+        area.addr = pcm.planar ? buffers[channel] : buffers[0];
+        area.first = pcm.planar ? 0 : channel * sizeof_sample * 8;
+        area.step = pcm.planar ? sizeof_sample * 8 : pcm.frame_bytes * 8;
+    }
+    return pcm.transfer_areas.data();
+}
+
+// Keeps frames frames played at the application pointer for the loopback,
+// taken from areas from offset on.
+static void sim_play(sim_pcm &pcm, const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames) {
+    if (sim_loopback_frames < 0) { return; }
+    for (snd_pcm_uframes_t index = 0; index < frames; ++index) {
+        uint8_t *played = &pcm.history[((pcm.appl_ptr + index) % pcm.history_frames) * pcm.frame_bytes];
+        for (int channel = 0; channel < pcm.channels; ++channel) {
+            memcpy(played + channel * sizeof_sample, sim_area_sample(areas[channel], offset + index), sizeof_sample);
+        }
+    }
+}
+
+// Fills frames captured frames from the application pointer on, into
+// areas from offset on, with what the linked playback device played
+// sim_loopback_frames earlier, silence where it played nothing (or it is
+// no longer kept).
+static void sim_record(const sim_pcm &pcm, const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames) {
+    if (pcm.planar) {
+        for (int channel = 0; channel < pcm.channels; ++channel) {
+            memset(sim_area_sample(areas[channel], offset), 0, frames * sizeof_sample);
+        }
+    }
+    else {
+        memset(sim_area_sample(areas[0], offset), 0, frames * pcm.frame_bytes);
+    }
+
+    const sim_pcm *playback = pcm.linked;
+    if (sim_loopback_frames < 0 || !playback || playback->history.empty()) { return; }
+
+    const int channels = std::min(pcm.channels, playback->channels);
+    for (snd_pcm_uframes_t index = 0; index < frames; ++index) {
+        const uint64_t position = pcm.appl_ptr + index;
+        if (position < (uint64_t)sim_loopback_frames) { continue; }
+        const uint64_t played = position - sim_loopback_frames;
+        if (played >= playback->appl_ptr || played + playback->history_frames < playback->appl_ptr) { continue; }
+        const uint8_t *samples = &playback->history[(played % playback->history_frames) * playback->frame_bytes];
+        for (int channel = 0; channel < channels; ++channel) {
+            memcpy(sim_area_sample(areas[channel], offset + index), samples + channel * sizeof_sample, sizeof_sample);
+        }
+    }
+}
+
+static void sim_set_timer(sim_pcm &pcm, int64_t ns) {
+    itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    // 0 disarms, anything in the past fires right away
+    timer.it_value.tv_sec = ns / 1000000000LL;
+    timer.it_value.tv_nsec = ns % 1000000000LL;
+    timerfd_settime(pcm.timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+static void sim_xrun(sim_pcm &pcm) {
+    pcm.state = SND_PCM_STATE_XRUN;
+    if (pcm.linked && pcm.linked->state == SND_PCM_STATE_RUNNING) {
+        pcm.linked->state = SND_PCM_STATE_XRUN;
+        sim_set_timer(*pcm.linked, 1);
+    }
+}
+
+// Moves the device forward to now_ns and returns its hardware pointer.
+static uint64_t sim_update(sim_pcm &pcm, int64_t now_ns) {
+    if (pcm.state != SND_PCM_STATE_RUNNING) { return 0; }
+
+    const uint64_t burst = sim_current_burst(pcm, now_ns);
+    const uint64_t hw_ptr = burst * pcm.burst_frames;
+
+    if (pcm.next_xrun_burst && burst >= pcm.next_xrun_burst) {
+        pcm.next_xrun_burst = burst + pcm.xrun_interval_bursts;
+        sim_xrun(pcm);
+    }
+    else if (pcm.stream == SND_PCM_STREAM_CAPTURE ? hw_ptr > pcm.appl_ptr + pcm.buffer_frames : hw_ptr > pcm.appl_ptr) {
+        sim_xrun(pcm);
+    }
+
+    return hw_ptr;
+}
+
+static snd_pcm_sframes_t sim_avail_at(sim_pcm &pcm, int64_t now_ns) {
+    const uint64_t hw_ptr = sim_update(pcm, now_ns);
+    switch (pcm.state) {
+        case SND_PCM_STATE_PREPARED:
+            return pcm.stream == SND_PCM_STREAM_CAPTURE ? 0 : pcm.buffer_frames - pcm.appl_ptr;
+        case SND_PCM_STATE_RUNNING:
+            return pcm.stream == SND_PCM_STREAM_CAPTURE ? hw_ptr - pcm.appl_ptr : pcm.buffer_frames - (pcm.appl_ptr - hw_ptr);
+        case SND_PCM_STATE_XRUN:
+            return -EPIPE;
+        default:
+            return -EBADFD;
+    }
+}
+
+// Arms the timer for the moment the device becomes ready (avail reaches
+// avail_min, or an xrun is due), or disarms it if that won't happen on
+// its own.
+static void sim_arm(sim_pcm &pcm) {
+    const int64_t now_ns = sim_now_ns();
+    const snd_pcm_sframes_t avail = sim_avail_at(pcm, now_ns);
+
+    if (avail < 0 || (pcm.period_wakeup && avail >= (snd_pcm_sframes_t)pcm.period_frames)) {
+        sim_set_timer(pcm, pcm.state == SND_PCM_STATE_SETUP || pcm.state == SND_PCM_STATE_OPEN ? 0 : 1);
+        return;
+    }
+
+    if (pcm.state != SND_PCM_STATE_RUNNING) {
+        sim_set_timer(pcm, 0);
+        return;
+    }
+
+    // the hardware pointer at which avail reaches avail_min
+    const uint64_t ready_ptr = (pcm.stream == SND_PCM_STREAM_CAPTURE) ? pcm.appl_ptr + pcm.period_frames : pcm.appl_ptr + pcm.period_frames - pcm.buffer_frames;
+    uint64_t burst = pcm.period_wakeup ? (ready_ptr + pcm.burst_frames - 1) / pcm.burst_frames : UINT64_MAX;
+    if (pcm.next_xrun_burst && pcm.next_xrun_burst < burst) { burst = pcm.next_xrun_burst; }
+    sim_set_timer(pcm, burst == UINT64_MAX ? 0 : sim_burst_time(pcm, burst));
+}
+
+static void sim_start(sim_pcm &pcm) {
+    const int64_t now_ns = sim_now_ns();
+    sim_pcm *pcms[] = { &pcm, pcm.linked };
+    for (sim_pcm *started : pcms) {
+        if (!started || started->state != SND_PCM_STATE_PREPARED) { continue; }
+        started->state = SND_PCM_STATE_RUNNING;
+        started->start_ns = now_ns;
+        started->next_xrun_burst = started->xrun_interval_bursts;
+        sim_arm(*started);
+    }
+}
+
+// Advances the application pointer after frames were transferred and
+// starts playback once the start threshold (a period, as in
+// setup_pcm_device) is reached.
+static void sim_transferred(sim_pcm &pcm, snd_pcm_uframes_t frames) {
+    pcm.appl_ptr += frames;
+    if (pcm.stream == SND_PCM_STREAM_PLAYBACK && pcm.state == SND_PCM_STATE_PREPARED && pcm.appl_ptr >= pcm.period_frames) {
+        sim_start(pcm);
+    }
+    sim_arm(pcm);
+}
+
+static int sim_open(pcm_handle **pcm, const char *, snd_pcm_stream_t stream) {
+    sim_pcm *device = new sim_pcm();
+    device->stream = stream;
+    device->state = SND_PCM_STATE_OPEN;
+    device->linked = nullptr;
+    device->buffer = nullptr;
+    device->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (device->timer_fd < 0) {
+        int error = errno;
+        delete device;
+        return -error;
+    }
+    *pcm = (pcm_handle*)device;
+    return 0;
+}
+
+static int sim_setup(pcm_handle *pcm, int channels) {
+    sim_pcm &device = *sim(pcm);
+    if (device.state != SND_PCM_STATE_OPEN) {
+        fprintf(stderr, "Error: sim_setup: device already set up\n");
+        exit(EXIT_FAILURE);
+    }
+
+    device.channels = channels;
+    device.frame_bytes = channels * sizeof_sample;
+    device.planar = planar_access;
+    device.period_frames = period_size_frames;
+    device.period_wakeup = !tsched;
+    device.burst_frames = device.period_wakeup ? period_size_frames : std::max(std::min(sampling_rate_hz / 1000, period_size_frames), 1);
+    device.buffer_frames = device_buffer_frames;
+    device.buffer = new uint8_t[device.buffer_frames * device.frame_bytes]();
+    // what is still in the buffer, read up to a buffer late plus the delay
+    device.history_frames = 2 * device.buffer_frames + std::max(sim_loopback_frames, 0);
+    device.history.assign((device.stream == SND_PCM_STREAM_PLAYBACK && sim_loopback_frames >= 0) ? device.history_frames * device.frame_bytes : 0, 0);
+    device.areas.resize(channels);
+    device.transfer_areas.resize(channels);
+    for (int channel = 0; channel < channels; ++channel) {
+        device.areas[channel].addr = device.buffer;
+        if (device.planar) {
+            device.areas[channel].first = channel * device.buffer_frames * sizeof_sample * 8;
+            device.areas[channel].step = sizeof_sample * 8;
+        }
+        else {
+            device.areas[channel].first = channel * sizeof_sample * 8;
+            device.areas[channel].step = device.frame_bytes * 8;
+        }
+    }
+
+    // keep the boundaries in order
+    device.clock_scale = 1 / (1 + sim_drift_ppm * 1e-6);
+    const int64_t burst_ns = sim_frames_ns(device.burst_frames) * device.clock_scale;
+    device.jitter_ns = std::min((int64_t)sim_jitter_us * 1000, burst_ns - 1);
+    device.appl_ptr = 0;
+    device.xrun_interval_bursts = (uint64_t)sim_xrun_interval * device.period_frames / device.burst_frames;
+    device.next_xrun_burst = 0;
+    device.state = SND_PCM_STATE_PREPARED;
+    sim_arm(device);
+
+    if (verbose) { fprintf(stderr, "Done.\n"); }
+
+    return EXIT_SUCCESS;
+}
+
+static int sim_link(pcm_handle *pcm1, pcm_handle *pcm2) {
+    sim(pcm1)->linked = sim(pcm2);
+    sim(pcm2)->linked = sim(pcm1);
+    return 0;
+}
+
+static int sim_unlink(pcm_handle *pcm) {
+    if (!sim(pcm)->linked) { return -EALREADY; }
+    sim(pcm)->linked->linked = nullptr;
+    sim(pcm)->linked = nullptr;
+    return 0;
+}
+
+static int sim_drop(pcm_handle *pcm) {
+    sim_pcm *pcms[] = { sim(pcm), sim(pcm)->linked };
+    for (sim_pcm *dropped : pcms) {
+        if (!dropped) { continue; }
+        if (dropped->state == SND_PCM_STATE_OPEN) { return -EBADFD; }
+        dropped->state = SND_PCM_STATE_SETUP;
+        sim_set_timer(*dropped, 0);
+    }
+    return 0;
+}
+
+// Prepares the device and the linked one again after an xrun, with the
+// application pointers back at 0. Other errors are returned, as
+// snd_pcm_recover does.
+static int sim_recover(pcm_handle *pcm, int err) {
+    if (err != -EPIPE) { return err; }
+
+    sim_pcm *pcms[] = { sim(pcm), sim(pcm)->linked };
+    for (sim_pcm *prepared : pcms) {
+        if (!prepared) { continue; }
+        if (prepared->state == SND_PCM_STATE_OPEN || prepared->state == SND_PCM_STATE_SETUP) { return -EBADFD; }
+        prepared->state = SND_PCM_STATE_PREPARED;
+        prepared->appl_ptr = 0;
+        prepared->next_xrun_burst = 0;
+        sim_arm(*prepared);
+    }
+    return 0;
+}
+
+static int sim_hw_free(pcm_handle *pcm) {
+    sim_pcm &device = *sim(pcm);
+    if (device.state == SND_PCM_STATE_RUNNING || device.state == SND_PCM_STATE_XRUN) { return -EBADFD; }
+    delete[] device.buffer;
+    device.buffer = nullptr;
+    device.state = SND_PCM_STATE_OPEN;
+    sim_set_timer(device, 0);
+    return 0;
+}
+
+static snd_pcm_state_t sim_state(pcm_handle *pcm) {
+    sim_update(*sim(pcm), sim_now_ns());
+    return sim(pcm)->state;
+}
+
+static snd_pcm_sframes_t sim_avail(pcm_handle *pcm) {
+    return sim_avail_at(*sim(pcm), sim_now_ns());
+}
+
+static snd_pcm_sframes_t sim_read(pcm_handle *pcm, void *const *buffers, snd_pcm_uframes_t frames) {
+    sim_pcm &device = *sim(pcm);
+    if (device.state == SND_PCM_STATE_PREPARED) { sim_start(device); }
+
+    snd_pcm_sframes_t avail = sim_avail(pcm);
+    if (avail < 0) { return avail; }
+    const snd_pcm_uframes_t transferred = std::min(frames, (snd_pcm_uframes_t)avail);
+    if (transferred == 0) { return -EAGAIN; }
+
+    sim_record(device, sim_transfer_areas(device, buffers), 0, transferred);
+    sim_transferred(device, transferred);
+    return transferred;
+}
+
+static snd_pcm_sframes_t sim_write(pcm_handle *pcm, void *const *buffers, snd_pcm_uframes_t frames) {
+    snd_pcm_sframes_t avail = sim_avail(pcm);
+    if (avail < 0) { return avail; }
+    const snd_pcm_uframes_t transferred = std::min(frames, (snd_pcm_uframes_t)avail);
+    if (transferred == 0) { return -EAGAIN; }
+
+    sim_play(*sim(pcm), sim_transfer_areas(*sim(pcm), buffers), 0, transferred);
+    sim_transferred(*sim(pcm), transferred);
+    return transferred;
+}
+
+static snd_pcm_sframes_t sim_readi(pcm_handle *pcm, void *buffer, snd_pcm_uframes_t frames) { return sim_read(pcm, &buffer, frames); }
+
+static snd_pcm_sframes_t sim_writei(pcm_handle *pcm, const void *buffer, snd_pcm_uframes_t frames) {
+    void *buffers[] = { (void*)buffer };
+    return sim_write(pcm, buffers, frames);
+}
+
+static snd_pcm_sframes_t sim_readn(pcm_handle *pcm, void **buffers, snd_pcm_uframes_t frames) { return sim_read(pcm, buffers, frames); }
+static snd_pcm_sframes_t sim_writen(pcm_handle *pcm, void **buffers, snd_pcm_uframes_t frames) { return sim_write(pcm, buffers, frames); }
+
+static int sim_mmap_begin(pcm_handle *pcm, const snd_pcm_channel_area_t **areas, snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames) {
+    sim_pcm &device = *sim(pcm);
+    snd_pcm_sframes_t avail = sim_avail(pcm);
+    if (avail < 0) { return avail; }
+
+    *areas = device.areas.data();
+    *offset = device.appl_ptr % device.buffer_frames;
+    *frames = std::min(std::min(*frames, (snd_pcm_uframes_t)avail), device.buffer_frames - *offset);
+    if (device.stream == SND_PCM_STREAM_CAPTURE) { sim_record(device, device.areas.data(), *offset, *frames); }
+    return 0;
+}
+
+static snd_pcm_sframes_t sim_mmap_commit(pcm_handle *pcm, snd_pcm_uframes_t offset, snd_pcm_uframes_t frames) {
+    sim_pcm &device = *sim(pcm);
+    snd_pcm_sframes_t avail = sim_avail(pcm);
+    if (avail < 0) { return avail; }
+
+    if (device.stream == SND_PCM_STREAM_PLAYBACK) { sim_play(device, device.areas.data(), offset, frames); }
+    sim_transferred(*sim(pcm), frames);
+    return frames;
+}
+
+static int sim_poll_descriptors_count(pcm_handle *) {
+    return 1;
+}
+
+static int sim_poll_descriptors(pcm_handle *pcm, pollfd *pfds, unsigned int space) {
+    if (space < 1) { return 0; }
+    pfds[0].fd = sim(pcm)->timer_fd;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    return 1;
+}
+
+static int sim_poll_descriptors_revents(pcm_handle *pcm, pollfd *pfds, unsigned int nfds, unsigned short *revents) {
+    sim_pcm &device = *sim(pcm);
+    *revents = 0;
+    if (nfds < 1 || !(pfds[0].revents & POLLIN)) { return 0; }
+
+    uint64_t expirations;
+    if (read(device.timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) { return -errno; }
+
+    const snd_pcm_sframes_t avail = sim_avail(pcm);
+    if (avail < 0) {
+        *revents = POLLERR;
+    }
+    else if (avail >= (snd_pcm_sframes_t)device.period_frames) {
+        *revents = (device.stream == SND_PCM_STREAM_CAPTURE) ? POLLIN : POLLOUT;
+    }
+
+    // stays readable while ready, like a real device
+    sim_arm(device);
+    return 0;
+}
+
+static inline timespec sim_timespec(int64_t ns) {
+    timespec time;
+    time.tv_sec = ns / 1000000000LL;
+    time.tv_nsec = ns % 1000000000LL;
+    return time;
+}
+
+// The tstamp is the burst boundary that last moved the hardware pointer,
+// the audio tstamp its position at the nominal rate, as the compat audio
+// timestamps of alsa are.
+static int sim_status(pcm_handle *pcm, pcm_status *status) {
+    sim_pcm &device = *sim(pcm);
+    const int64_t now_ns = sim_now_ns();
+    const snd_pcm_sframes_t avail = sim_avail_at(device, now_ns);
+    const bool started = (device.state == SND_PCM_STATE_RUNNING || device.state == SND_PCM_STATE_XRUN);
+    const uint64_t burst = started ? sim_current_burst(device, now_ns) : 0;
+
+    status->state = device.state;
+    status->trigger_tstamp = sim_timespec(started ? device.start_ns : 0);
+    status->tstamp = sim_timespec(started ? sim_burst_time(device, burst) : now_ns);
+    status->audio_tstamp = sim_timespec(sim_frames_ns(burst * device.burst_frames));
+    status->avail = std::max(avail, (snd_pcm_sframes_t)0);
+    status->delay = (avail < 0) ? 0 : (device.stream == SND_PCM_STREAM_CAPTURE) ? avail : device.buffer_frames - avail;
+    return 0;
+}
+
+static int sim_card(pcm_handle *) {
+    return -ENODEV;
+}
+
+// Every format is native, nothing sits between the loops and the device.
+static int sim_native_formats(const char *, snd_pcm_stream_t) {
+    return (1 << trace_num_sample_formats) - 1;
+}
+
+const pcm_backend sim_backend = {
+    "sim",
+    sim_open,
+    sim_setup,
+    sim_link,
+    sim_unlink,
+    sim_drop,
+    sim_recover,
+    sim_hw_free,
+    sim_state,
+    sim_avail,
+    sim_avail,
+    sim_readi,
+    sim_writei,
+    sim_writei,
+    sim_readn,
+    sim_writen,
+    sim_writen,
+    sim_mmap_begin,
+    sim_mmap_commit,
+    sim_poll_descriptors_count,
+    sim_poll_descriptors,
+    sim_poll_descriptors_revents,
+    sim_status,
+    sim_card,
+    sim_native_formats,
+};
@@ -0,0 +1,240 @@
+// #################### split capture/playback threads
+//
+// Runs capture and playback in two threads connected only by the
+// ringbuffer. Each waits on its own device with the --wait strategy. Both
+// inherit the SCHED_FIFO policy and priority of the main thread. The
+// capture thread reads, simulates the processing load and publishes every
+// processed block, the playback thread writes whatever has been published
+// so far. Each thread records its own samples (the capture
+// thread the capture columns and fill, the playback thread the playback
+// columns and the published, not yet written frames as drain), which are
+// merged by wakeup time on output (or streamed through one queue each).
+
+struct split_thread {
+    const char *name;
+    pcm_device *device;
+    pcm_handle *pcm;
+    bool capture;
+    wait_context waits;
+    phase_timer timer;
+    int sample_count;
+    pthread_t thread;
+};
+
+split_thread split_threads[2];
+std::atomic<bool> split_stop(false);
+cycle_engine_functions split_engine;
+// both threads and the one that prefills, which starts the devices
+pthread_barrier_t split_start;
+
+static void *split_thread_main(void *arg) {
+    split_thread &self = *(split_thread*)arg;
+    spsc_ringbuffer &ring = self.device->ring;
+
+    int ret;
+    int fill = 0;
+    uint64_t cycles = 0;
+
+    perf_counters counters;
+    if (perf_counters_enabled) {
+        counters.open();
+        counters.start();
+    }
+    rusage usage_start;
+    getrusage(RUSAGE_THREAD, &usage_start);
+    attach_live_thread(self.capture ? 0 : 1);
+
+    // ready, wait for the prefill
+    pthread_barrier_wait(&split_start);
+
+    while (!split_stop.load(std::memory_order_relaxed) && !stop_requested) {
+        data data_sample;
+
+        self.timer.start();
+        clock_gettime(CLOCK_MONOTONIC, &data_sample.wakeup_time);
+
+        if (backend->state(self.pcm) == SND_PCM_STATE_XRUN) {
+            if (!split_stop.load()) { fprintf(stderr, "Error: %s xrun\n", self.name); }
+            break;
+        }
+        self.timer.mark(phase_state);
+
+        snd_pcm_sframes_t waited_avail;
+        unsigned short revents;
+
+        ret = strategy->wait(self.waits, &waited_avail, &revents);
+        self.timer.mark(phase_wait);
+        if (ret == -EINTR) { break; }
+        if (ret < 0) {
+            fprintf(stderr, "Error: %s wait: %s\n", self.name, snd_strerror(ret));
+            break;
+        }
+
+        if (revents & POLLIN) { data_sample.poll_pollin = 1; }
+        if (revents & POLLOUT) { data_sample.poll_pollout = 1; }
+
+        const int64_t woken_ns = wait_now_ns();
+
+        if (driver_timestamps) {
+            ret = record_driver_status(data_sample, woken_ns, self.device->index, self.waits.pcms, self.waits.streams, 1);
+            self.timer.mark(phase_state);
+            if (ret < 0) {
+                fprintf(stderr, "Error: %s snd_pcm_status: %s. frame: %d\n", self.name, snd_strerror(ret), self.sample_count);
+                break;
+            }
+        }
+
+        int avail = waited_avail;
+        if (avail < 0) {
+            if (!split_stop.load()) { fprintf(stderr, "Error: %s avail: %s. frame: %d\n", self.name, snd_strerror(avail), self.sample_count); }
+            break;
+        }
+
+        if (self.capture) {
+            data_sample.capture_available = avail;
+
+            int frames_to_read = std::min(avail, ring.writable());
+            if (frames_to_read > 0) {
+                int frames_read = split_engine.capture(*self.device, frames_to_read, self.timer);
+                if (frames_read < 0) {
+                    fprintf(stderr, "Error: capture: %s. frame: %d\n", snd_strerror(frames_read), self.sample_count);
+                    break;
+                }
+
+                if (roundtrip_signal != roundtrip_none) { roundtrip_tap(ring, frames_read); }
+
+                data_sample.capture_read = frames_read;
+                fill += frames_read;
+                self.waits.transferred[0] += frames_read;
+            }
+
+            self.timer.mark(phase_other);
+            while (fill >= processing_buffer_frames) {
+                apply_load(*self.device);
+                self.timer.mark(phase_load);
+
+                ring.publish(processing_buffer_frames);
+                fill -= processing_buffer_frames;
+            }
+        }
+        else {
+            data_sample.playback_available = avail;
+
+            int frames_to_write = std::min(avail, ring.readable());
+            if (frames_to_write > 0) {
+                if (roundtrip_signal != roundtrip_none) { roundtrip_inject(ring, self.waits.transferred[0], frames_to_write); }
+                self.timer.mark(phase_other);
+                int frames_written = split_engine.playback(*self.device, frames_to_write, self.timer);
+                if (frames_written < 0) {
+                    fprintf(stderr, "Error: playback: %s. frame: %d\n", snd_strerror(frames_written), self.sample_count);
+                    break;
+                }
+
+                data_sample.playback_written = frames_written;
+                self.waits.transferred[0] += frames_written;
+            }
+        }
+
+        data_sample.io_ns = wait_now_ns() - woken_ns;
+        data_sample.cycles = cycles;
+
+        ++cycles;
+
+        if (data_sample.playback_written == 0 && data_sample.capture_read == 0) {
+            usleep(busy_sleep_us);
+            continue;
+        }
+
+        data_sample.fill = fill;
+        data_sample.drain = ring.readable();
+        data_sample.valid = 1;
+        self.timer.finish(data_sample.phase_ns);
+        if (perf_counters_enabled) { counters.sample(data_sample.perf_deltas); }
+
+        if (print_summary_stats || summary_interval_s > 0) {
+            thread_stats[self.capture ? 0 : 1].record(data_sample);
+            if (phase_timing) { thread_phase_stats[self.capture ? 0 : 1].record(data_sample); }
+            if (perf_counters_enabled) { thread_perf_stats[self.capture ? 0 : 1].record(data_sample); }
+        }
+        live_record(self.capture ? 0 : 1, data_sample, 0);
+
+        if (stream_samples) {
+            sample_stream_push(sample_streams[self.capture ? 0 : 1], data_sample);
+        }
+        else if (print_table) {
+            sample_stores[self.capture ? 0 : 1].push(data_sample);
+        }
+
+        ++self.sample_count;
+        if (sample_size && self.sample_count >= sample_size) {
+            break;
+        }
+    }
+
+    // The other thread notices once its stream runs dry and xruns.
+    split_stop.store(true);
+
+    rusage usage_end;
+    getrusage(RUSAGE_THREAD, &usage_end);
+    thread_minor_faults[self.capture ? 0 : 1] = usage_end.ru_minflt - usage_start.ru_minflt;
+
+    return NULL;
+}
+
+// Creates both threads with everything set up, waiting for
+// run_split_threads. The capture thread stores into the first sample
+// store, the playback thread into the second. Before the prefill, so the
+// devices don't run while the threads start.
+void start_split_threads(pcm_device &device, const cycle_engine_functions &engine) {
+    split_stop.store(false);
+    split_engine = engine;
+    pthread_barrier_init(&split_start, NULL, 3);
+
+    split_threads[0].name = "capture";
+    split_threads[0].device = &device;
+    split_threads[0].pcm = device.capture;
+    split_threads[0].capture = true;
+    split_threads[1].name = "playback";
+    split_threads[1].device = &device;
+    split_threads[1].pcm = device.playback;
+    split_threads[1].capture = false;
+
+    for (split_thread &thread : split_threads) {
+        const snd_pcm_stream_t stream = thread.capture ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK;
+        thread.timer.enabled = phase_timing;
+        setup_wait_context(thread.waits, 1, &thread.pcm, &stream, thread.capture ? 0 : 1, &thread.timer);
+        // the prefill
+        if (!thread.capture) { thread.waits.transferred[0] = buffer_size_frames; }
+        thread.sample_count = 0;
+    }
+
+    for (split_thread &thread : split_threads) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        // everything is locked, so don't lock the default 8 MB of stack
+        pthread_attr_setstacksize(&attr, 256 * 1024);
+
+        int ret = pthread_create(&thread.thread, &attr, split_thread_main, &thread);
+        if (ret != 0) {
+            fprintf(stderr, "Error: pthread_create: %s\n", strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+}
+
+// After the prefill: lets both threads sample until either has collected
+// sample_size samples or failed.
+void run_split_threads() {
+    pthread_barrier_wait(&split_start);
+
+    for (split_thread &thread : split_threads) {
+        pthread_join(thread.thread, NULL);
+    }
+
+    for (split_thread &thread : split_threads) {
+        release_wait_context(thread.waits);
+    }
+    pthread_barrier_destroy(&split_start);
+}
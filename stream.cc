@@ -0,0 +1,122 @@
+// #################### sample streaming
+//
+// For runs of unbounded length the sampling threads push every record into
+// a preallocated lock-free queue instead of keeping it, and a low priority
+// writer thread drains the queues to the output. Memory use is fixed by
+// the queue size no matter how long the run is. If the writer falls
+// behind, records are dropped and counted rather than ever blocking a
+// sampling thread.
+
+struct sample_stream {
+    spsc_queue<data> queue;
+    std::atomic<uint64_t> dropped;
+};
+
+// One stream per sampling thread.
+sample_stream sample_streams[max_sampling_threads];
+int num_sample_streams = 0;
+
+pthread_t stream_writer_thread;
+std::atomic<bool> stream_writer_stop(false);
+
+void sample_stream_push(sample_stream &stream, const data &data_sample) {
+    if (!stream.queue.push(data_sample)) {
+        stream.dropped.store(stream.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+// Pops and prints the oldest record across all streams. Returns false if
+// all streams are empty.
+static bool stream_writer_print_one(FILE *output, sample_totals &totals) {
+    sample_stream *oldest = nullptr;
+    for (int index = 0; index < num_sample_streams; ++index) {
+        const data *candidate = sample_streams[index].queue.front();
+        if (!candidate) { continue; }
+        if (!oldest) { oldest = &sample_streams[index]; continue; }
+
+        const data *current = oldest->queue.front();
+        if (candidate->wakeup_time.tv_sec < current->wakeup_time.tv_sec ||
+            (candidate->wakeup_time.tv_sec == current->wakeup_time.tv_sec && candidate->wakeup_time.tv_nsec < current->wakeup_time.tv_nsec)) {
+            oldest = &sample_streams[index];
+        }
+    }
+
+    if (!oldest) { return false; }
+
+    output_corunner_phases(output, &oldest->queue.front()->wakeup_time);
+    output_sample(output, *oldest->queue.front(), totals);
+    oldest->queue.pop();
+    return true;
+}
+
+static void *stream_writer_main(void *arg) {
+    FILE *output = (FILE*)arg;
+    sample_totals totals;
+
+    output_header(output);
+
+    while (true) {
+        // read the flag first so nothing pushed before stopping is missed
+        bool stopping = stream_writer_stop.load();
+
+        int printed = 0;
+        while (stream_writer_print_one(output, totals)) { ++printed; }
+
+        if (stopping) {
+            // the co-runners have stopped by now
+            output_corunner_phases(output, nullptr);
+            break;
+        }
+
+        if (printed && !binary_output) { fflush(output); }
+
+        timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = 10000000;
+        nanosleep(&ts, NULL);
+    }
+
+    output_finish(output);
+    return NULL;
+}
+
+// Allocates streams queues of queue_size records each and starts the
+// writer thread with SCHED_OTHER, whatever the calling thread runs at.
+void start_stream_writer(FILE *output, int streams, int queue_size) {
+    num_sample_streams = streams;
+    for (int index = 0; index < num_sample_streams; ++index) {
+        sample_streams[index].queue.allocate(queue_size);
+        sample_streams[index].dropped.store(0);
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    sched_param param;
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+    // everything is locked, so don't lock the default 8 MB of stack
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+
+    int ret = pthread_create(&stream_writer_thread, &attr, stream_writer_main, output);
+    if (ret != 0) {
+        fprintf(stderr, "Error: pthread_create: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+// Lets the writer drain what is left, joins it and reports drops.
+void stop_stream_writer() {
+    stream_writer_stop.store(true);
+    pthread_join(stream_writer_thread, NULL);
+
+    for (int index = 0; index < num_sample_streams; ++index) {
+        uint64_t dropped = sample_streams[index].dropped.load();
+        if (dropped) {
+            fprintf(stderr, "Warning: stream %d dropped %lu samples, try a larger --stream-queue-size\n", index, dropped);
+        }
+    }
+}
@@ -0,0 +1,125 @@
+// #################### summary reports
+//
+// Every sampling thread owns one sample_stats, one tsched_stats that is
+// only filled by --wait tsched, one phase_stats only filled with
+// --phase-timing and one perf_stats only filled with --perf-counters: the
+// thread of each device, or the capture and the playback thread of the
+// split mode. They are printed at the end of the run and, optionally,
+// periodically by a low priority reporter thread while sampling runs.
+
+const int max_sampling_threads = max_pcm_devices;
+
+sample_stats thread_stats[max_sampling_threads];
+tsched_stats thread_tsched_stats[max_sampling_threads];
+phase_stats thread_phase_stats[max_sampling_threads];
+perf_stats thread_perf_stats[max_sampling_threads];
+// while sampling, taken when the thread finishes
+long thread_minor_faults[max_sampling_threads];
+std::string thread_stats_titles[max_sampling_threads];
+int num_thread_stats = 0;
+
+pthread_t summary_reporter_thread;
+std::atomic<bool> summary_reporter_stop(false);
+int summary_reporter_interval_s;
+
+// The number of sampling threads of a measurement.
+int num_sampling_threads() {
+    return (num_threads == 2) ? 2 : num_pcm_devices;
+}
+
+// Names the stats of the sampling threads for the reports.
+void setup_thread_stats() {
+    num_thread_stats = num_sampling_threads();
+    if (num_threads == 2) {
+        thread_stats_titles[0] = "capture thread summary";
+        thread_stats_titles[1] = "playback thread summary";
+    }
+    else if (num_pcm_devices == 1) {
+        thread_stats_titles[0] = "summary";
+    }
+    else {
+        for (int index = 0; index < num_pcm_devices; ++index) {
+            thread_stats_titles[index] = pcm_devices[index].name + " summary";
+        }
+    }
+}
+
+// Starts the stats of the next measurement of a sweep from scratch.
+void reset_thread_stats() {
+    for (int index = 0; index < num_thread_stats; ++index) {
+        thread_stats[index].reset();
+        thread_tsched_stats[index].reset();
+        thread_phase_stats[index].reset();
+        thread_perf_stats[index].reset();
+        thread_minor_faults[index] = 0;
+    }
+}
+
+void print_summary(FILE *file) {
+    for (int index = 0; index < num_thread_stats; ++index) {
+        print_sample_stats(file, thread_stats_titles[index].c_str(), thread_stats[index]);
+        if (tsched) { print_tsched_stats(file, thread_tsched_stats[index]); }
+        if (phase_timing) { print_phase_stats(file, thread_phase_stats[index]); }
+        if (perf_counters_enabled) { print_perf_stats(file, thread_perf_stats[index]); }
+    }
+}
+
+// At the end of a measurement: how many minor faults every sampling thread
+// took in its loop, which should be none with everything prefaulted.
+void print_thread_minor_faults(FILE *file) {
+    for (int index = 0; index < num_thread_stats; ++index) {
+        fprintf(file, "%s: %ld minor faults while sampling\n", thread_stats_titles[index].c_str(), thread_minor_faults[index]);
+    }
+}
+
+// The cpu time and context switches of the whole process between start
+// and end, to compare the cost of the wait strategies.
+void print_resource_usage(FILE *file, const rusage &start, const rusage &end, int64_t wall_ns) {
+    const int64_t user_us = (end.ru_utime.tv_sec - start.ru_utime.tv_sec) * 1000000LL + (end.ru_utime.tv_usec - start.ru_utime.tv_usec);
+    const int64_t system_us = (end.ru_stime.tv_sec - start.ru_stime.tv_sec) * 1000000LL + (end.ru_stime.tv_usec - start.ru_stime.tv_usec);
+    fprintf(file, "cpu: user %.3f s, system %.3f s, %.1f%% of %.3f s, context switches: %ld voluntary, %ld involuntary\n", user_us * 1e-6, system_us * 1e-6, wall_ns > 0 ? 100.0 * (user_us + system_us) * 1000 / wall_ns : 0.0, wall_ns * 1e-9, end.ru_nvcsw - start.ru_nvcsw, end.ru_nivcsw - start.ru_nivcsw);
+}
+
+static void *summary_reporter_main(void *) {
+    int elapsed_ms = 0;
+    while (!summary_reporter_stop.load()) {
+        timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = 100000000;
+        nanosleep(&ts, NULL);
+
+        elapsed_ms += 100;
+        if (elapsed_ms % (1000 * summary_reporter_interval_s) == 0) {
+            fprintf(stderr, "after %d s:\n", elapsed_ms / 1000);
+            print_summary(stderr);
+        }
+    }
+    return NULL;
+}
+
+// Starts the periodic reporter with SCHED_OTHER.
+void start_summary_reporter(int interval_s) {
+    summary_reporter_interval_s = interval_s;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    sched_param param;
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+
+    int ret = pthread_create(&summary_reporter_thread, &attr, summary_reporter_main, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Error: pthread_create: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+void stop_summary_reporter() {
+    summary_reporter_stop.store(true);
+    pthread_join(summary_reporter_thread, NULL);
+}
@@ -0,0 +1,160 @@
+// #################### parameter sweeps
+//
+// A sweep runs one measurement for every combination of period size,
+// number of periods, processing buffer size and load, repeated
+// sweep_repetitions times, in one warm process: memory is locked and
+// prefaulted once, the scheduling setup is done once and the pcm devices
+// stay open and are only reconfigured between the measurements. A plain
+// run is a sweep of a single point.
+
+struct sweep_point {
+    int repetition;
+    int period_size_frames;
+    int num_periods;
+    int processing_buffer_frames;
+    int load_percent;
+    int sample_size;
+};
+
+std::vector<sweep_point> sweep_points;
+
+// Parses a comma separated list of values and ranges. A range is
+// first:last[:step], where the step is added, or multiplied if written as
+// xN, so 16:1024:x2 is every power of two from 16 to 1024.
+std::vector<int> parse_sweep_values(const char *name, const std::string &spec) {
+    std::vector<int> values;
+
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) { end = spec.size(); }
+        const std::string item = spec.substr(start, end - start);
+        start = end + 1;
+
+        int first, last, step = 1;
+        char step_kind = '+';
+        char trailing;
+        if (sscanf(item.c_str(), "%d:%d:x%d%c", &first, &last, &step, &trailing) == 3) {
+            step_kind = 'x';
+        }
+        else if (sscanf(item.c_str(), "%d:%d:%d%c", &first, &last, &step, &trailing) == 3 ||
+                 sscanf(item.c_str(), "%d:%d%c", &first, &last, &trailing) == 2) {
+
+        }
+        else if (sscanf(item.c_str(), "%d%c", &first, &trailing) == 1) {
+            last = first;
+        }
+        else {
+            fprintf(stderr, "Error: invalid --sweep-%s item: '%s'\n", name, item.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        if ((step_kind == '+' && step < 1) || (step_kind == 'x' && (step < 2 || first < 1)) || last < first) {
+            fprintf(stderr, "Error: invalid --sweep-%s range: '%s'\n", name, item.c_str());
+            exit(EXIT_FAILURE);
+        }
+
+        for (long value = first; value <= last; value = (step_kind == 'x') ? value * step : value + step) {
+            values.push_back(value);
+        }
+    }
+
+    return values;
+}
+
+// Builds sweep_points from the --sweep-* lists, or the single point of a
+// plain run from the regular options. Points that don't leave room for two
+// processing buffers are skipped in a sweep and an error otherwise.
+void setup_sweep(bool sweep, const std::string &period_sizes, const std::string &periods, const std::string &processing_buffer_sizes, const std::string &loads, int repetitions, int seconds) {
+    std::vector<int> period_size_values(1, period_size_frames);
+    std::vector<int> num_periods_values(1, num_periods);
+    std::vector<int> processing_buffer_values(1, processing_buffer_frames);
+    std::vector<int> load_values(1, sleep_percent);
+
+    if (sweep) {
+        if (!period_sizes.empty()) { period_size_values = parse_sweep_values("period-size", period_sizes); }
+        if (!periods.empty()) { num_periods_values = parse_sweep_values("number-of-periods", periods); }
+        if (!processing_buffer_sizes.empty()) { processing_buffer_values = parse_sweep_values("processing-buffer-size", processing_buffer_sizes); }
+        if (!loads.empty()) { load_values = parse_sweep_values("load", loads); }
+    }
+    else {
+        repetitions = 1;
+        seconds = 0;
+    }
+
+    sweep_points.clear();
+    for (int repetition = 1; repetition <= repetitions; ++repetition) {
+        for (int period_size : period_size_values) {
+            for (int periods_count : num_periods_values) {
+                for (int processing_buffer : processing_buffer_values) {
+                    for (int load : load_values) {
+                        if (2 * processing_buffer > period_size * periods_count) {
+                            if (!sweep) {
+                                fprintf(stderr, "Error: period-size * number-of-periods < 2 * processing-buffer-size.\n");
+                                exit(EXIT_FAILURE);
+                            }
+                            if (repetition == 1) {
+                                fprintf(stderr, "Warning: skipping period-size %d number-of-periods %d processing-buffer-size %d: period-size * number-of-periods < 2 * processing-buffer-size\n", period_size, periods_count, processing_buffer);
+                            }
+                            continue;
+                        }
+
+                        sweep_point point;
+                        point.repetition = repetition;
+                        point.period_size_frames = period_size;
+                        point.num_periods = periods_count;
+                        point.processing_buffer_frames = (processing_buffer == -1) ? period_size : processing_buffer;
+                        point.load_percent = load;
+                        point.sample_size = seconds ? std::max(1, seconds * sampling_rate_hz / period_size) : sample_size;
+                        sweep_points.push_back(point);
+                    }
+                }
+            }
+        }
+    }
+
+    if (sweep_points.empty()) {
+        fprintf(stderr, "Error: the sweep has no valid points\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// The largest buffer any point uses, to allocate buffers once.
+int sweep_max_buffer_size_frames() {
+    int frames = 0;
+    for (const sweep_point &point : sweep_points) {
+        frames = std::max(frames, point.period_size_frames * point.num_periods);
+    }
+    return frames;
+}
+
+// The most samples any point collects, to size the run arena.
+int sweep_max_sample_size() {
+    int size = 0;
+    for (const sweep_point &point : sweep_points) {
+        size = std::max(size, point.sample_size);
+    }
+    return size;
+}
+
+void apply_sweep_point(const sweep_point &point) {
+    period_size_frames = point.period_size_frames;
+    num_periods = point.num_periods;
+    buffer_size_frames = point.period_size_frames * point.num_periods;
+    device_buffer_frames = tsched ? std::max(tsched_buffer_frames, buffer_size_frames) : buffer_size_frames;
+    processing_buffer_frames = point.processing_buffer_frames;
+    sleep_percent = point.load_percent;
+    sample_size = point.sample_size;
+}
+
+void print_sweep_point(FILE *file, const sweep_point &point) {
+    fprintf(file, "period-size %d number-of-periods %d processing-buffer-size %d load %d repetition %d\n", point.period_size_frames, point.num_periods, point.processing_buffer_frames, point.load_percent, point.repetition);
+}
+
+// The output of one point of a sweep goes to its own file, named after
+// the --output prefix and the parameters.
+std::string sweep_output_file_name(const std::string &prefix, const sweep_point &point) {
+    char suffix[256];
+    snprintf(suffix, sizeof(suffix), "_nperiods_%d_periodsize_%d_processing_%d_load_%d_index_%d.%s", point.num_periods, point.period_size_frames, point.processing_buffer_frames, point.load_percent, point.repetition, binary_output ? "trace" : "txt");
+    return prefix + suffix;
+}
@@ -0,0 +1,158 @@
+// #################### driver timestamps
+//
+// With --driver-timestamps every sampling thread queries the status of its
+// devices right after the wait returned, which splits each cycle into:
+//
+// hw-lag-ns  the time from the last hardware pointer update to the end of
+//            the wait: the interrupt to wakeup latency with poll, shorter
+//            with strategies that sync the pointer themselves
+// io-ns      the time from the end of the wait until the transfers of the
+//            cycle are done (always recorded)
+// delay-w/r  the delay the driver reports for each device
+//
+// Every status also pairs a system timestamp with an audio timestamp, the
+// hardware position by the audio clock. A least squares fit of one over the
+// other gives the true rate of each device clock and its drift against
+// CLOCK_MONOTONIC. The audio timestamps start over whenever the device is
+// triggered again after an xrun, so each run of a device between triggers
+// is a segment of its own, and the fit shares the slope across all
+// segments while every segment keeps its own offset.
+
+struct clock_estimate {
+    timespec trigger_tstamp;
+    bool has_origin;
+    int64_t origin_tstamp_ns;
+    int64_t origin_audio_ns;
+    uint64_t count;
+    // of the current segment
+    uint64_t segment_count;
+    double sum_x;
+    double sum_y;
+    double sum_xx;
+    double sum_xy;
+    // the centered sums of the finished segments
+    double finished_sxx;
+    double finished_sxy;
+
+    clock_estimate() {
+        reset();
+    }
+
+    void reset() {
+        trigger_tstamp = timespec{0, 0};
+        has_origin = false;
+        count = segment_count = 0;
+        sum_x = sum_y = sum_xx = sum_xy = 0;
+        finished_sxx = finished_sxy = 0;
+    }
+
+    // Drivers without audio timestamps report zeros, which are skipped.
+    void record(const pcm_status &status) {
+        const int64_t tstamp_ns = status.tstamp.tv_sec * 1000000000LL + status.tstamp.tv_nsec;
+        const int64_t audio_ns = status.audio_tstamp.tv_sec * 1000000000LL + status.audio_tstamp.tv_nsec;
+        if (status.state != SND_PCM_STATE_RUNNING || audio_ns == 0) { return; }
+
+        if (has_origin && (status.trigger_tstamp.tv_sec != trigger_tstamp.tv_sec || status.trigger_tstamp.tv_nsec != trigger_tstamp.tv_nsec)) {
+            finished_sxx += centered_sxx();
+            finished_sxy += centered_sxy();
+            has_origin = false;
+        }
+
+        if (!has_origin) {
+            has_origin = true;
+            trigger_tstamp = status.trigger_tstamp;
+            origin_tstamp_ns = tstamp_ns;
+            origin_audio_ns = audio_ns;
+            segment_count = 0;
+            sum_x = sum_y = sum_xx = sum_xy = 0;
+        }
+
+        // seconds since the first status keep the sums precise
+        const double x = (tstamp_ns - origin_tstamp_ns) * 1e-9;
+        const double y = (audio_ns - origin_audio_ns) * 1e-9;
+        ++count;
+        ++segment_count;
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+
+    double centered_sxx() const {
+        return segment_count ? sum_xx - sum_x * sum_x / segment_count : 0;
+    }
+
+    double centered_sxy() const {
+        return segment_count ? sum_xy - sum_x * sum_y / segment_count : 0;
+    }
+
+    // Audio seconds per system second, 0 without enough data.
+    double slope() const {
+        const double sxx = finished_sxx + centered_sxx();
+        if (count < 2 || sxx <= 0) { return 0; }
+        return (finished_sxy + centered_sxy()) / sxx;
+    }
+};
+
+// Per device, indexed like the wait contexts of the single thread loop:
+// playback, capture. Each has a single writer, the thread sampling the
+// device.
+clock_estimate stream_clocks[max_pcm_devices][2];
+
+static inline int stream_index(snd_pcm_stream_t stream) {
+    return (stream == SND_PCM_STREAM_CAPTURE) ? 1 : 0;
+}
+
+void reset_clock_estimates() {
+    for (clock_estimate (&clocks)[2] : stream_clocks) {
+        for (clock_estimate &clock : clocks) { clock.reset(); }
+    }
+}
+
+// Fills the delay and hw-lag columns from the status of the pcms of a
+// sampling thread, which belong to device. woken_ns is the end of the wait.
+int record_driver_status(data &data_sample, int64_t woken_ns, int device, pcm_handle *const *pcms, const snd_pcm_stream_t *streams, int num_pcms) {
+    int64_t lag_ns = INT64_MAX;
+
+    for (int index = 0; index < num_pcms; ++index) {
+        pcm_status status;
+        int ret = backend->status(pcms[index], &status);
+        if (ret < 0) { return ret; }
+
+        if (streams[index] == SND_PCM_STREAM_CAPTURE) {
+            data_sample.capture_delay = status.delay;
+        }
+        else {
+            data_sample.playback_delay = status.delay;
+        }
+
+        if (status.state == SND_PCM_STATE_RUNNING) {
+            const int64_t tstamp_ns = status.tstamp.tv_sec * 1000000000LL + status.tstamp.tv_nsec;
+            lag_ns = std::min(lag_ns, woken_ns - tstamp_ns);
+        }
+
+        stream_clocks[device][stream_index(streams[index])].record(status);
+    }
+
+    if (lag_ns != INT64_MAX) {
+        data_sample.hw_lag_ns = std::min(std::max(lag_ns, (int64_t)0), (int64_t)INT32_MAX);
+    }
+    return 0;
+}
+
+void print_clock_estimates(FILE *file) {
+    const char *names[] = { "playback", "capture" };
+    for (int device = 0; device < num_pcm_devices; ++device) {
+        for (int index = 0; index < 2; ++index) {
+            const clock_estimate &clock = stream_clocks[device][index];
+            const double slope = clock.slope();
+            // name the device only if there are several
+            const std::string prefix = (num_pcm_devices > 1) ? (index ? pcm_devices[device].capture_name : pcm_devices[device].name) + " " : "";
+            if (slope == 0) {
+                fprintf(file, "%s%s clock: no audio timestamps\n", prefix.c_str(), names[index]);
+                continue;
+            }
+            fprintf(file, "%s%s clock: triggered at %ld.%09ld, rate %.3f hz, drift %+.2f ppm from %lu timestamps\n", prefix.c_str(), names[index], clock.trigger_tstamp.tv_sec, clock.trigger_tstamp.tv_nsec, slope * sampling_rate_hz, (slope - 1) * 1e6, clock.count);
+        }
+    }
+}
@@ -0,0 +1,347 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+
+// #################### binary trace format
+//
+// A trace is a trace_header_bytes header followed by fixed size records,
+// everything little-endian regardless of the host:
+//
+// header
+//    0 char[8]  magic "APSTRACE"
+//    8 u32      version
+//   12 u32      header size in bytes
+//   16 u32      record size in bytes
+//   20 i32 x 10 period size, number of periods, rate, input channels,
+//               output channels, bytes per sample, processing buffer size,
+//               load percent, sampling threads, access (bit 0: mmap,
+//               bit 1: planar)
+//   60 char[128] pcm device names, space separated, zero padded
+//  188 char[16] conversion kernels, zero padded
+//  204 u32      optional record fields (bit 0: phases, bit 1: perf counters,
+//               version 4)
+//  208 u32      sample format, an index into trace_sample_format_names
+//               (version 5, before that S16LE or S32LE by the sample size)
+//
+// record
+//    0 u64      cycles
+//    8 i64      wakeup time seconds (CLOCK_MONOTONIC)
+//   16 i32      wakeup time nanoseconds
+//   20 u8       record type (0: sample)
+//   21 u8       flags (bit 0: valid, bit 1: POLLIN, bit 2: POLLOUT)
+//   22 u16      device index (reserved, so 0, in older traces)
+//   24 i32 x 6  avail-w, avail-r, written, read, fill, drain
+//   48 i32 x 4  delay-w, delay-r, hw-lag-ns, io-ns (version 2)
+//   64 u16 x 10 the durations of the cycle phases in trace_phase_names
+//               order, as trace_encode_duration codes (version 3, only in
+//               traces with --phase-timing, which have 84 byte records)
+//   84 u32 x 6  the perf counter deltas since the previous sample in
+//               trace_perf_counter_names order (version 4, only in traces
+//               with --perf-counters, which have 108 byte records)
+//
+// co-runner phase record, at the start of every on and off phase
+//    0 u64      the operations of the co-runner so far
+//    8 i64      phase start seconds (CLOCK_MONOTONIC)
+//   16 i32      phase start nanoseconds
+//   20 u8       record type (1: co-runner phase)
+//   21 u8       flags (bit 0: on)
+//   22 u16      co-runner index
+//   24 i32 x 2  kind (an index into trace_corunner_kind_names), cpu (-1:
+//               not pinned)
+//
+// Readers must use the sizes from the header, so later versions can grow
+// both without breaking them. Fields past the record size of an older
+// trace decode as 0.
+// Readers skip record types they don't know.
+
+const char trace_magic[8] = { 'A', 'P', 'S', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t trace_version = 5;
+const uint32_t trace_header_bytes = 256;
+const uint32_t trace_record_bytes = 64;
+// with the cycle phases
+const uint32_t trace_phase_record_bytes = 84;
+// with the perf counters, and the phases in front of them
+const uint32_t trace_perf_record_bytes = 108;
+// the record size of version 1
+const uint32_t trace_min_record_bytes = 48;
+
+enum {
+    trace_flag_valid = 1,
+    trace_flag_pollin = 2,
+    trace_flag_pollout = 4,
+};
+
+enum {
+    trace_fields_phases = 1,
+    trace_fields_perf_counters = 2,
+};
+
+enum {
+    trace_access_mmap = 1,
+    trace_access_planar = 2,
+};
+
+// By the access bits.
+const char *const trace_access_names[] = { "rw", "mmap", "rw-planar", "mmap-planar" };
+
+enum {
+    trace_record_sample = 0,
+    trace_record_corunner_phase = 1,
+};
+
+enum {
+    trace_flag_corunner_on = 1,
+};
+
+const char *const trace_sample_format_names[] = { "S16LE", "S24LE", "S24_3LE", "S32LE", "FLOATLE" };
+const int trace_num_sample_formats = sizeof(trace_sample_format_names) / sizeof(trace_sample_format_names[0]);
+
+const char *const trace_phase_names[] = { "state", "wait", "revents", "avail", "read", "convert-in", "load", "convert-out", "write", "other" };
+const int trace_num_phases = sizeof(trace_phase_names) / sizeof(trace_phase_names[0]);
+
+// The width of the <name>-ns column of a phase in text tables.
+static inline int trace_phase_column_width(int phase) {
+    const int width = strlen(trace_phase_names[phase]) + 3;
+    return width > 10 ? width : 10;
+}
+
+const char *const trace_perf_counter_names[] = { "instructions", "cycles", "llc-misses", "ctx-switches", "migrations", "page-faults" };
+const int trace_num_perf_counters = sizeof(trace_perf_counter_names) / sizeof(trace_perf_counter_names[0]);
+
+// The width of the column of a perf counter in text tables.
+static inline int trace_perf_counter_column_width(int counter) {
+    const int width = strlen(trace_perf_counter_names[counter]);
+    return width > 10 ? width : 10;
+}
+
+const char *const trace_corunner_kind_names[] = { "membw", "cache", "syscall", "pagefault" };
+const int trace_num_corunner_kinds = sizeof(trace_corunner_kind_names) / sizeof(trace_corunner_kind_names[0]);
+
+struct trace_header {
+    uint32_t version;
+    uint32_t header_bytes;
+    uint32_t record_bytes;
+    int32_t period_size_frames;
+    int32_t num_periods;
+    int32_t sampling_rate_hz;
+    int32_t input_channels;
+    int32_t output_channels;
+    int32_t sample_bytes;
+    int32_t processing_buffer_frames;
+    int32_t load_percent;
+    int32_t threads;
+    int32_t access;
+    char pcm_device_name[128];
+    char conversion_kernels[16];
+    uint32_t record_fields;
+    uint32_t sample_format;
+};
+
+struct trace_record {
+    uint64_t cycles;
+    int64_t tv_sec;
+    int32_t tv_nsec;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t device;
+    int32_t playback_available;
+    int32_t capture_available;
+    int32_t playback_written;
+    int32_t capture_read;
+    int32_t fill;
+    int32_t drain;
+    int32_t playback_delay;
+    int32_t capture_delay;
+    int32_t hw_lag_ns;
+    int32_t io_ns;
+    uint16_t phase_codes[trace_num_phases];
+    uint32_t perf_deltas[trace_num_perf_counters];
+};
+
+static inline void trace_put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static inline void trace_put_u32(uint8_t *out, uint32_t value) {
+    for (int index = 0; index < 4; ++index) { out[index] = value >> (8 * index); }
+}
+
+static inline void trace_put_u64(uint8_t *out, uint64_t value) {
+    for (int index = 0; index < 8; ++index) { out[index] = value >> (8 * index); }
+}
+
+static inline uint16_t trace_get_u16(const uint8_t *in) {
+    return in[0] | (uint16_t)in[1] << 8;
+}
+
+static inline uint32_t trace_get_u32(const uint8_t *in) {
+    uint32_t value = 0;
+    for (int index = 0; index < 4; ++index) { value |= (uint32_t)in[index] << (8 * index); }
+    return value;
+}
+
+static inline uint64_t trace_get_u64(const uint8_t *in) {
+    uint64_t value = 0;
+    for (int index = 0; index < 8; ++index) { value |= (uint64_t)in[index] << (8 * index); }
+    return value;
+}
+
+// Durations in 16 bits: exact below 2048 ns, above within 1/1024 of the
+// value, with a power of two exponent in the upper bits.
+static inline uint16_t trace_encode_duration(uint32_t ns) {
+    if (ns < 2048) { return ns; }
+    const int shift = 31 - __builtin_clz(ns) - 10;
+    return ((shift + 1) << 10) + ((ns >> shift) - 1024);
+}
+
+static inline uint32_t trace_decode_duration(uint16_t code) {
+    if (code < 2048) { return code; }
+    const int shift = (code >> 10) - 1;
+    // the middle of the range the code stands for
+    return (((code & 1023) + 1024) << shift) + (1u << shift) / 2;
+}
+
+void trace_encode_header(const trace_header &header, uint8_t *out) {
+    memset(out, 0, trace_header_bytes);
+    memcpy(out, trace_magic, sizeof(trace_magic));
+    trace_put_u32(out + 8, header.version);
+    trace_put_u32(out + 12, header.header_bytes);
+    trace_put_u32(out + 16, header.record_bytes);
+    const int32_t parameters[] = { header.period_size_frames, header.num_periods, header.sampling_rate_hz, header.input_channels, header.output_channels, header.sample_bytes, header.processing_buffer_frames, header.load_percent, header.threads, header.access };
+    for (int index = 0; index < 10; ++index) {
+        trace_put_u32(out + 20 + 4 * index, parameters[index]);
+    }
+    memcpy(out + 60, header.pcm_device_name, strnlen(header.pcm_device_name, sizeof(header.pcm_device_name) - 1));
+    memcpy(out + 188, header.conversion_kernels, strnlen(header.conversion_kernels, sizeof(header.conversion_kernels) - 1));
+    trace_put_u32(out + 204, header.record_fields);
+    trace_put_u32(out + 208, header.sample_format);
+}
+
+// Returns false if in does not start with a trace header.
+bool trace_decode_header(const uint8_t *in, size_t size, trace_header &header) {
+    if (size < 60 || memcmp(in, trace_magic, sizeof(trace_magic)) != 0) { return false; }
+
+    memset(&header, 0, sizeof(header));
+    header.version = trace_get_u32(in + 8);
+    header.header_bytes = trace_get_u32(in + 12);
+    header.record_bytes = trace_get_u32(in + 16);
+    if (header.header_bytes < trace_header_bytes || header.header_bytes > size || header.record_bytes < trace_min_record_bytes) { return false; }
+
+    int32_t *parameters[] = { &header.period_size_frames, &header.num_periods, &header.sampling_rate_hz, &header.input_channels, &header.output_channels, &header.sample_bytes, &header.processing_buffer_frames, &header.load_percent, &header.threads, &header.access };
+    for (int index = 0; index < 10; ++index) {
+        *parameters[index] = trace_get_u32(in + 20 + 4 * index);
+    }
+    memcpy(header.pcm_device_name, in + 60, sizeof(header.pcm_device_name) - 1);
+    memcpy(header.conversion_kernels, in + 188, sizeof(header.conversion_kernels) - 1);
+    header.record_fields = trace_get_u32(in + 204);
+    // version 3 had only the phases, told apart by the record size
+    if (header.version == 3 && header.record_bytes >= trace_phase_record_bytes) { header.record_fields = trace_fields_phases; }
+    header.sample_format = trace_get_u32(in + 208);
+    // S16LE or S32LE
+    if (header.version < 5) { header.sample_format = (header.sample_bytes == 2) ? 0 : 3; }
+    return true;
+}
+
+// Encodes a record of record_bytes bytes, with the phases and the perf
+// counters if it is long enough for them.
+void trace_encode_record(const trace_record &record, uint8_t *out, uint32_t record_bytes) {
+    trace_put_u64(out, record.cycles);
+    trace_put_u64(out + 8, record.tv_sec);
+    trace_put_u32(out + 16, record.tv_nsec);
+    out[20] = record.type;
+    out[21] = record.flags;
+    trace_put_u16(out + 22, record.device);
+    const int32_t fields[] = { record.playback_available, record.capture_available, record.playback_written, record.capture_read, record.fill, record.drain, record.playback_delay, record.capture_delay, record.hw_lag_ns, record.io_ns };
+    for (int index = 0; index < 10; ++index) {
+        trace_put_u32(out + 24 + 4 * index, fields[index]);
+    }
+    if (record_bytes >= trace_phase_record_bytes) {
+        for (int phase = 0; phase < trace_num_phases; ++phase) {
+            trace_put_u16(out + 64 + 2 * phase, record.phase_codes[phase]);
+        }
+    }
+    if (record_bytes >= trace_perf_record_bytes) {
+        for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+            trace_put_u32(out + 84 + 4 * counter, record.perf_deltas[counter]);
+        }
+    }
+}
+
+void trace_decode_record(const uint8_t *in, uint32_t record_bytes, trace_record &record) {
+    record.cycles = trace_get_u64(in);
+    record.tv_sec = trace_get_u64(in + 8);
+    record.tv_nsec = trace_get_u32(in + 16);
+    record.type = in[20];
+    record.flags = in[21];
+    record.device = trace_get_u16(in + 22);
+    int32_t *fields[] = { &record.playback_available, &record.capture_available, &record.playback_written, &record.capture_read, &record.fill, &record.drain, &record.playback_delay, &record.capture_delay, &record.hw_lag_ns, &record.io_ns };
+    for (int index = 0; index < 10; ++index) {
+        *fields[index] = (24 + 4 * (uint32_t)index < record_bytes) ? trace_get_u32(in + 24 + 4 * index) : 0;
+    }
+    for (int phase = 0; phase < trace_num_phases; ++phase) {
+        record.phase_codes[phase] = (record_bytes >= trace_phase_record_bytes) ? trace_get_u16(in + 64 + 2 * phase) : 0;
+    }
+    for (int counter = 0; counter < trace_num_perf_counters; ++counter) {
+        record.perf_deltas[counter] = (record_bytes >= trace_perf_record_bytes) ? trace_get_u32(in + 84 + 4 * counter) : 0;
+    }
+}
+
+// #################### trace loader
+//
+// Maps a whole trace read-only, so loading costs one mmap no matter the
+// size and records decode straight out of the page cache.
+
+struct trace_file {
+    int fd;
+    const uint8_t *bytes;
+    size_t size;
+    trace_header header;
+    size_t num_records;
+
+    trace_file() :
+        fd(-1),
+        bytes(nullptr),
+        size(0),
+        num_records(0) {
+
+    }
+
+    ~trace_file() {
+        if (bytes) { munmap((void*)bytes, size); }
+        if (fd >= 0) { close(fd); }
+    }
+
+    // Returns an error message or an empty string on success.
+    std::string open(const char *path) {
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) { return std::string("open: ") + strerror(errno); }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) { return std::string("fstat: ") + strerror(errno); }
+        size = info.st_size;
+        if (size == 0) { return "empty file"; }
+
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) { return std::string("mmap: ") + strerror(errno); }
+        bytes = (const uint8_t*)mapped;
+        madvise(mapped, size, MADV_SEQUENTIAL);
+
+        if (!trace_decode_header(bytes, size, header)) { return "not a trace file"; }
+        if (header.version > trace_version) { return "unsupported trace version"; }
+
+        num_records = (size - header.header_bytes) / header.record_bytes;
+        return "";
+    }
+
+    inline void record(size_t index, trace_record &out) const {
+        trace_decode_record(bytes + header.header_bytes + index * header.record_bytes, header.record_bytes, out);
+    }
+};
@@ -0,0 +1,394 @@
+// #################### wait strategies
+//
+// How a sampling thread waits for its devices between cycles, picked with
+// --wait. All strategies wake up under the same condition, a device having
+// at least avail_min (a period) frames available or being in error, and
+// report the same avail and revents values, so their results compare
+// directly:
+//
+// poll    poll() on the descriptors, which are fetched once per measurement
+// epoll   epoll_wait() on the same descriptors, registered once
+// spin    snd_pcm_avail() in a tight loop
+// usleep  snd_pcm_avail(), sleeping busy_sleep_us between tries
+// hybrid  snd_pcm_avail() for an adaptive spin window, then poll()
+// tsched  clock_nanosleep() until the deadline a delay-locked loop predicts
+//
+// A device is ready once a period of frames is available for capture, or
+// the queued playback frames fell a period below the latency. Without
+// tsched the hardware buffer is the latency, so both are avail_min.
+//
+// The hybrid window follows the waits it could have caught: a wait that
+// ends while spinning, or shortly after blocking, pulls the window towards
+// twice its length, a long wait shrinks it by an eighth. It never grows
+// beyond hybrid_max_spin_us.
+//
+// tsched runs the devices with period wakeups disabled and a hardware
+// buffer of tsched_buffer_frames, like the timer scheduling of PulseAudio
+// and PipeWire, and wakes itself up at the predicted moment a device
+// becomes ready. The prediction comes from a second order delay-locked
+// loop (after Fons Adriaensen, "Using a DLL to filter time") over the
+// hardware positions seen at every observation, so it follows the device
+// clock rather than the nominal rate. At the deadline the wait returns
+// whether a device is ready or not, as the processing of timer scheduled
+// audio does.
+
+const double tsched_dll_bandwidth_hz = 1.0;
+
+// The filtered time at which the hardware position was position.
+struct tsched_dll {
+    bool locked;
+    double time_ns;
+    int64_t position;
+    double ns_per_frame;
+
+    void reset() {
+        locked = false;
+        time_ns = 0;
+        position = 0;
+        ns_per_frame = 1e9 / sampling_rate_hz;
+    }
+
+    double time_at(int64_t target) const {
+        return time_ns + (target - position) * ns_per_frame;
+    }
+
+    // Observations without progress say nothing about when the position
+    // was reached, so only advancing ones are filtered.
+    void update(int64_t now_ns, int64_t observed) {
+        if (!locked) {
+            locked = true;
+            time_ns = now_ns;
+            position = observed;
+            return;
+        }
+        if (observed <= position) { return; }
+
+        const double omega = 2 * M_PI * tsched_dll_bandwidth_hz * (now_ns - time_ns) * 1e-9;
+        const double predicted_ns = time_at(observed);
+        const double error_ns = now_ns - predicted_ns;
+        ns_per_frame += omega * omega * error_ns / (observed - position);
+        time_ns = predicted_ns + M_SQRT2 * omega * error_ns;
+        position = observed;
+    }
+};
+
+const int max_wait_pcms = 2;
+
+struct wait_context {
+    int num_pcms;
+    pcm_handle *pcms[max_wait_pcms];
+    snd_pcm_stream_t streams[max_wait_pcms];
+    // the descriptors of pcm i are pfds[pfds_offsets[i]] up to
+    // pfds[pfds_offsets[i + 1]]
+    int pfds_offsets[max_wait_pcms + 1];
+    pollfd *pfds;
+    int epoll_fd;
+    epoll_event *events;
+    int64_t spin_window_ns;
+    // the frames the caller transferred, for the hardware positions
+    uint64_t transferred[max_wait_pcms];
+    tsched_dll dlls[max_wait_pcms];
+    int thread_index;
+    // of the sampling thread, for the wait phases
+    phase_timer *timer;
+};
+
+struct wait_strategy {
+    const char *name;
+    // Waits until at least one device is ready, then stores the avail and
+    // the revents (POLLIN, POLLOUT or POLLERR) of every device. Returns 0,
+    // -EINTR once a stop was requested or another negative error code.
+    int (*wait)(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents);
+};
+
+static inline int64_t wait_now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// After poll() or epoll_wait(): the revents from the descriptors, the
+// avail as of the last hardware pointer update.
+static int wait_collect(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    context.timer->mark(phase_wait);
+    for (int index = 0; index < context.num_pcms; ++index) {
+        const int offset = context.pfds_offsets[index];
+        int ret = backend->poll_descriptors_revents(context.pcms[index], context.pfds + offset, context.pfds_offsets[index + 1] - offset, &revents[index]);
+        context.timer->mark(phase_revents);
+        if (ret < 0) { return ret; }
+        avail[index] = backend->avail_update(context.pcms[index]);
+        context.timer->mark(phase_avail);
+    }
+    return 0;
+}
+
+static inline bool wait_is_capture(const wait_context &context, int index) {
+    return context.streams[index] == SND_PCM_STREAM_CAPTURE;
+}
+
+// The avail at which a device is ready.
+static inline snd_pcm_sframes_t wait_ready_avail(const wait_context &context, int index) {
+    return wait_is_capture(context, index) ? period_size_frames : device_buffer_frames - buffer_size_frames + period_size_frames;
+}
+
+// The frames the hardware has captured or played since the start.
+static inline int64_t wait_position(const wait_context &context, int index, snd_pcm_sframes_t avail) {
+    return context.transferred[index] + avail - (wait_is_capture(context, index) ? 0 : device_buffer_frames);
+}
+
+static inline unsigned short wait_revents(const wait_context &context, int index, snd_pcm_sframes_t avail) {
+    if (avail < 0) { return POLLERR; }
+    if (avail < wait_ready_avail(context, index)) { return 0; }
+    return wait_is_capture(context, index) ? POLLIN : POLLOUT;
+}
+
+// Without descriptors: syncs the hardware pointers and derives the
+// revents from avail. Returns whether any device is ready.
+static bool wait_check(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    bool ready = false;
+    for (int index = 0; index < context.num_pcms; ++index) {
+        avail[index] = backend->avail(context.pcms[index]);
+        revents[index] = wait_revents(context, index, avail[index]);
+        ready = ready || revents[index];
+    }
+    return ready;
+}
+
+static int wait_block_in_poll(wait_context &context) {
+    int ret = poll(context.pfds, context.pfds_offsets[context.num_pcms], 100000);
+    if (ret < 0) { return stop_requested ? -EINTR : -errno; }
+    if (ret == 0) { return -ETIMEDOUT; }
+    return 0;
+}
+
+static int wait_poll(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    int ret = wait_block_in_poll(context);
+    if (ret < 0) { return ret; }
+    return wait_collect(context, avail, revents);
+}
+
+static int wait_epoll(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    const int nfds = context.pfds_offsets[context.num_pcms];
+    int ret = epoll_wait(context.epoll_fd, context.events, nfds, 100000);
+    if (ret < 0) { return stop_requested ? -EINTR : -errno; }
+    if (ret == 0) { return -ETIMEDOUT; }
+
+    for (int index = 0; index < nfds; ++index) { context.pfds[index].revents = 0; }
+    for (int index = 0; index < ret; ++index) {
+        // the poll and epoll event bits are the same
+        context.pfds[context.events[index].data.u32].revents = context.events[index].events;
+    }
+    return wait_collect(context, avail, revents);
+}
+
+static int wait_spin(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    while (!wait_check(context, avail, revents)) {
+        if (stop_requested) { return -EINTR; }
+    }
+    return 0;
+}
+
+static int wait_usleep(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    while (!wait_check(context, avail, revents)) {
+        if (stop_requested) { return -EINTR; }
+        usleep(busy_sleep_us);
+    }
+    return 0;
+}
+
+static int wait_hybrid(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    const int64_t max_spin_ns = hybrid_max_spin_us * 1000LL;
+    const int64_t start_ns = wait_now_ns();
+    int64_t waited_ns = 0;
+
+    while (!wait_check(context, avail, revents)) {
+        if (stop_requested) { return -EINTR; }
+
+        waited_ns = wait_now_ns() - start_ns;
+        if (waited_ns >= context.spin_window_ns) {
+            int ret = wait_poll(context, avail, revents);
+            if (ret < 0) { return ret; }
+
+            waited_ns = wait_now_ns() - start_ns;
+            if (waited_ns >= max_spin_ns) {
+                context.spin_window_ns -= context.spin_window_ns / 8;
+                return 0;
+            }
+            break;
+        }
+    }
+
+    context.spin_window_ns += (std::min(2 * waited_ns, max_spin_ns) - context.spin_window_ns) / 8;
+    return 0;
+}
+
+// The position at which tsched considers a device ready: where avail
+// reaches the ready avail, rounded down to the period grid of the
+// hardware position. After a partial transfer the next wakeup then lands
+// on the period boundary that completes it, as an interrupt would.
+static inline int64_t wait_tsched_target(const wait_context &context, int index) {
+    const int64_t ready = wait_position(context, index, wait_ready_avail(context, index));
+    return std::max(ready, (int64_t)0) / period_size_frames * period_size_frames;
+}
+
+// Observes all devices and feeds their positions to the loops. Returns
+// whether any device is ready or failed.
+static bool wait_observe(wait_context &context, int64_t now_ns, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    bool ready = false;
+    for (int index = 0; index < context.num_pcms; ++index) {
+        avail[index] = backend->avail(context.pcms[index]);
+        if (avail[index] < 0) {
+            revents[index] = POLLERR;
+        }
+        else {
+            const int64_t position = wait_position(context, index, avail[index]);
+            context.dlls[index].update(now_ns, position);
+            revents[index] = (position < wait_tsched_target(context, index)) ? 0 : wait_is_capture(context, index) ? POLLIN : POLLOUT;
+        }
+        ready = ready || revents[index];
+    }
+    return ready;
+}
+
+static void wait_record_tsched(wait_context &context, const snd_pcm_sframes_t *avail, const unsigned short *revents, int64_t now_ns) {
+    tsched_stats &stats = thread_tsched_stats[context.thread_index];
+    bool ready = false;
+    int64_t late_ns = INT64_MAX;
+    int64_t headroom_ns = INT64_MAX;
+    for (int index = 0; index < context.num_pcms; ++index) {
+        if (avail[index] < 0) { continue; }
+        const tsched_dll &dll = context.dlls[index];
+        if (revents[index]) {
+            ready = true;
+            const int64_t target = wait_tsched_target(context, index);
+            late_ns = std::min(late_ns, now_ns - (int64_t)dll.time_at(target));
+        }
+        headroom_ns = std::min(headroom_ns, (int64_t)((device_buffer_frames - avail[index]) * dll.ns_per_frame));
+    }
+
+    if (ready) {
+        stats.histograms[tsched_stats::wakeup_error_ns].record(std::max(late_ns, (int64_t)0));
+    }
+    else {
+        stats.early_wakeups.store(stats.early_wakeups.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    if (headroom_ns != INT64_MAX) {
+        stats.histograms[tsched_stats::headroom_ns].record(std::max(headroom_ns, (int64_t)0));
+    }
+}
+
+static int wait_tsched(wait_context &context, snd_pcm_sframes_t *avail, unsigned short *revents) {
+    int64_t now_ns = wait_now_ns();
+    if (wait_observe(context, now_ns, avail, revents)) {
+        wait_record_tsched(context, avail, revents, now_ns);
+        return 0;
+    }
+
+    int64_t deadline_ns = INT64_MAX;
+    for (int index = 0; index < context.num_pcms; ++index) {
+        deadline_ns = std::min(deadline_ns, (int64_t)context.dlls[index].time_at(wait_tsched_target(context, index)));
+    }
+
+    // already overdue by the prediction, but not ready yet: check back a
+    // little later instead of spinning
+    const int64_t retry_ns = 1000000000LL * period_size_frames / sampling_rate_hz / 16;
+    deadline_ns = std::max(deadline_ns, now_ns + retry_ns);
+
+    timespec deadline;
+    deadline.tv_sec = deadline_ns / 1000000000LL;
+    deadline.tv_nsec = deadline_ns % 1000000000LL;
+    int ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    if (ret != 0) { return stop_requested ? -EINTR : -ret; }
+
+    now_ns = wait_now_ns();
+    thread_tsched_stats[context.thread_index].histograms[tsched_stats::timer_latency_ns].record(now_ns - deadline_ns);
+
+    wait_observe(context, now_ns, avail, revents);
+    wait_record_tsched(context, avail, revents, now_ns);
+    return 0;
+}
+
+const wait_strategy all_wait_strategies[] = {
+    { "poll", wait_poll },
+    { "epoll", wait_epoll },
+    { "spin", wait_spin },
+    { "usleep", wait_usleep },
+    { "hybrid", wait_hybrid },
+    { "tsched", wait_tsched },
+};
+
+const int num_wait_strategies = sizeof(all_wait_strategies) / sizeof(all_wait_strategies[0]);
+
+const wait_strategy *strategy = &all_wait_strategies[0];
+
+// Returns nullptr for unknown names.
+const wait_strategy *find_wait_strategy(const std::string &name) {
+    for (int index = 0; index < num_wait_strategies; ++index) {
+        if (name == all_wait_strategies[index].name) { return &all_wait_strategies[index]; }
+    }
+    return nullptr;
+}
+
+// Fetches the poll descriptors of the set up devices once and registers
+// them with epoll if that is the strategy. thread_index picks the
+// thread_tsched_stats to record into, timer times the wait phases.
+void setup_wait_context(wait_context &context, int num_pcms, pcm_handle *const *pcms, const snd_pcm_stream_t *streams, int thread_index, phase_timer *timer) {
+    context.num_pcms = num_pcms;
+    context.thread_index = thread_index;
+    context.timer = timer;
+    context.pfds_offsets[0] = 0;
+    for (int index = 0; index < num_pcms; ++index) {
+        context.pcms[index] = pcms[index];
+        context.streams[index] = streams[index];
+        context.transferred[index] = 0;
+        context.dlls[index].reset();
+
+        int count = backend->poll_descriptors_count(pcms[index]);
+        if (count < 1) {
+            fprintf(stderr, "Error: poll descriptors count less than one\n");
+            exit(EXIT_FAILURE);
+        }
+        context.pfds_offsets[index + 1] = context.pfds_offsets[index] + count;
+    }
+
+    const int nfds = context.pfds_offsets[num_pcms];
+    context.pfds = new pollfd[nfds];
+    for (int index = 0; index < num_pcms; ++index) {
+        const int count = context.pfds_offsets[index + 1] - context.pfds_offsets[index];
+        if (backend->poll_descriptors(pcms[index], context.pfds + context.pfds_offsets[index], count) != count) {
+            fprintf(stderr, "Error: wrong fd count\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    context.epoll_fd = -1;
+    context.events = nullptr;
+    if (strategy->wait == wait_epoll) {
+        context.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (context.epoll_fd < 0) {
+            fprintf(stderr, "Error: epoll_create1: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        context.events = new epoll_event[nfds];
+        for (int index = 0; index < nfds; ++index) {
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = context.pfds[index].events;
+            event.data.u32 = index;
+            if (epoll_ctl(context.epoll_fd, EPOLL_CTL_ADD, context.pfds[index].fd, &event) != 0) {
+                fprintf(stderr, "Error: epoll_ctl: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    context.spin_window_ns = hybrid_max_spin_us * 1000LL / 2;
+}
+
+void release_wait_context(wait_context &context) {
+    delete[] context.pfds;
+    delete[] context.events;
+    if (context.epoll_fd >= 0) { close(context.epoll_fd); }
+}
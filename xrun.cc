@@ -0,0 +1,221 @@
+// #################### xrun recovery
+//
+// Without --xrun-recovery the first xrun ends the measurement. With it the
+// sampling thread recovers the linked devices (snd_pcm_recover prepares
+// them again), empties the ringbuffer, prefills the playback buffer with
+// silence as at the start and keeps sampling. Every xrun is logged to
+// stderr with the cycles that led up to it and how long the recovery took,
+// and the summary reports how often they happened. The sampling thread
+// only queues the log, a SCHED_OTHER logger thread prints it, so a slow
+// stderr can't eat into the freshly prefilled buffer.
+
+enum {
+    xrun_playback = 1,
+    xrun_capture = 2,
+};
+
+// The last cycles of a sampling thread, for the xrun log.
+struct xrun_history {
+    static const int size = 4;
+    data cycles[size];
+    int count;
+
+    xrun_history() :
+        count(0) {
+
+    }
+
+    inline void record(const data &data_sample) {
+        cycles[count % size] = data_sample;
+        ++count;
+    }
+};
+
+// Per device, written by its sampling thread only.
+struct xrun_stats {
+    uint64_t count;
+    uint64_t playback_count;
+    uint64_t capture_count;
+    int64_t recovery_ns;
+    int64_t max_recovery_ns;
+    // not logged because the log queue was full
+    uint64_t dropped_logs;
+
+    xrun_stats() {
+        reset();
+    }
+
+    void reset() {
+        count = playback_count = capture_count = 0;
+        recovery_ns = max_recovery_ns = 0;
+        dropped_logs = 0;
+    }
+};
+
+// An xrun and the cycles before it, from a sampling thread to the logger.
+struct xrun_record {
+    uint64_t number;
+    timespec time;
+    int directions;
+    int64_t recovery_ns;
+    int num_cycles;
+    data cycles[xrun_history::size];
+};
+
+const int xrun_log_queue_size = 64;
+
+xrun_stats device_xruns[max_pcm_devices];
+spsc_queue<xrun_record> xrun_logs[max_pcm_devices];
+
+pthread_t xrun_logger_thread;
+std::atomic<bool> xrun_logger_stop(false);
+
+void reset_xrun_stats() {
+    for (xrun_stats &stats : device_xruns) { stats.reset(); }
+}
+
+// What allocate_xrun_logs takes from the run arena.
+size_t xrun_logs_bytes() {
+    return num_pcm_devices * spsc_queue<xrun_record>::bytes_for(xrun_log_queue_size);
+}
+
+void allocate_xrun_logs() {
+    for (int index = 0; index < num_pcm_devices; ++index) { xrun_logs[index].allocate(xrun_log_queue_size); }
+}
+
+static bool is_xrun_error(int err) {
+    return err == -EPIPE || err == -ESTRPIPE;
+}
+
+// Which of the devices is in the xrun state, or both if the driver
+// doesn't tell.
+static int xrun_directions(const pcm_device &device) {
+    int directions = 0;
+    if (backend->state(device.playback) == SND_PCM_STATE_XRUN) { directions |= xrun_playback; }
+    if (backend->state(device.capture) == SND_PCM_STATE_XRUN) { directions |= xrun_capture; }
+    return directions ? directions : xrun_playback | xrun_capture;
+}
+
+static const char *xrun_direction_name(int directions) {
+    switch (directions) {
+        case xrun_playback: return "playback";
+        case xrun_capture: return "capture";
+        default: return "playback and capture";
+    }
+}
+
+// Recovers both devices from an xrun detected with err (-EPIPE if it was
+// the state). Returns 0 or the error of the recovery.
+int recover_pcm_device(pcm_device &device, int err) {
+    int ret = backend->recover(device.playback, err);
+    if (ret < 0) { return ret; }
+
+    // linked devices are prepared together, unless the link is emulated
+    if (backend->state(device.capture) == SND_PCM_STATE_XRUN) {
+        ret = backend->recover(device.capture, err);
+    }
+    return ret;
+}
+
+// Counts an xrun and queues its log with the cycles before it. From the
+// sampling thread of the device.
+void log_xrun(const pcm_device &device, const timespec &time, int directions, int64_t recovery_ns, const xrun_history &history) {
+    xrun_stats &stats = device_xruns[device.index];
+    ++stats.count;
+    if (directions & xrun_playback) { ++stats.playback_count; }
+    if (directions & xrun_capture) { ++stats.capture_count; }
+    stats.recovery_ns += recovery_ns;
+    stats.max_recovery_ns = std::max(stats.max_recovery_ns, recovery_ns);
+
+    xrun_record record;
+    record.number = stats.count;
+    record.time = time;
+    record.directions = directions;
+    record.recovery_ns = recovery_ns;
+    record.num_cycles = 0;
+    for (int index = std::max(history.count - xrun_history::size, 0); index < history.count; ++index) {
+        record.cycles[record.num_cycles++] = history.cycles[index % xrun_history::size];
+    }
+    if (!xrun_logs[device.index].push(record)) { ++stats.dropped_logs; }
+}
+
+static void print_xrun_record(FILE *file, const pcm_device &device, const xrun_record &record) {
+    fprintf(file, "xrun %lu on %s at %09ld.%09ld: %s, recovered in %.1f us\n", record.number, device.name.c_str(), record.time.tv_sec, record.time.tv_nsec, xrun_direction_name(record.directions), record.recovery_ns * 1e-3);
+    for (int index = 0; index < record.num_cycles; ++index) {
+        const data &cycle = record.cycles[index];
+        fprintf(file, "    cycle %lu at %09ld.%09ld: avail-w %d avail-r %d written %d read %d fill %d drain %d\n", cycle.cycles, cycle.wakeup_time.tv_sec, cycle.wakeup_time.tv_nsec, cycle.playback_available, cycle.capture_available, cycle.playback_written, cycle.capture_read, cycle.fill, cycle.drain);
+    }
+}
+
+static void print_xrun_logs(FILE *file) {
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        spsc_queue<xrun_record> &logs = xrun_logs[index];
+        while (const xrun_record *record = logs.front()) {
+            print_xrun_record(file, pcm_devices[index], *record);
+            logs.pop();
+        }
+    }
+}
+
+static void *xrun_logger_main(void *) {
+    while (true) {
+        // everything queued before the stop is printed
+        const bool stop = xrun_logger_stop.load();
+        print_xrun_logs(stderr);
+        if (stop) { break; }
+
+        timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = 100000000;
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+// Starts the logger with SCHED_OTHER and empty queues.
+void start_xrun_logger() {
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        while (xrun_logs[index].front()) { xrun_logs[index].pop(); }
+    }
+    xrun_logger_stop.store(false);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    sched_param param;
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+
+    int ret = pthread_create(&xrun_logger_thread, &attr, xrun_logger_main, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "Error: pthread_create xrun logger: %s\n", strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+// After the sampling threads joined: prints what is left and stops.
+void stop_xrun_logger() {
+    xrun_logger_stop.store(true);
+    pthread_join(xrun_logger_thread, NULL);
+}
+
+void print_xrun_stats(FILE *file, int64_t wall_ns) {
+    const double seconds = wall_ns * 1e-9;
+    for (int index = 0; index < num_pcm_devices; ++index) {
+        const xrun_stats &stats = device_xruns[index];
+        // name the device only if there are several
+        const std::string prefix = (num_pcm_devices > 1) ? pcm_devices[index].name + " " : "";
+        if (stats.count == 0) {
+            fprintf(file, "%sxruns: none in %.3f s\n", prefix.c_str(), seconds);
+            continue;
+        }
+        if (stats.dropped_logs) {
+            fprintf(file, "Warning: %s%lu xruns not logged, the log queue was full\n", prefix.c_str(), stats.dropped_logs);
+        }
+        fprintf(file, "%sxruns: %lu (%lu playback, %lu capture) in %.3f s, %.2f per hour, mean time between xruns %.3f s, recovery mean %.1f us max %.1f us\n", prefix.c_str(), stats.count, stats.playback_count, stats.capture_count, seconds, stats.count * 3600 / seconds, seconds / stats.count, stats.recovery_ns * 1e-3 / stats.count, stats.max_recovery_ns * 1e-3);
+    }
+}